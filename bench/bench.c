@@ -0,0 +1,709 @@
+/*
+  Headless packing benchmark. Runs every engine and heuristic in rbp/ over
+  generated sprite sizes and over size lists saved from real atlases, and
+  reports time, allocations, occupancy and pages for each run.
+
+  Size lists hold one "width height" pair per line, lines starting with #
+  are skipped. The editor writes them with Tools > Export sprite sizes.
+*/
+#define _POSIX_C_SOURCE 199309L
+
+#include "maxrects.h"
+#include "skyline.h"
+#include "guillotine.h"
+#include "shelf.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Allocations are counted when the link wraps the allocator
+// (-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free), which only
+// reroutes calls made from the objects of this program, the engines included.
+static long long benchAllocCount;
+static long long benchAllocBytes;
+
+#ifdef BENCH_WRAP_MALLOC
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+  benchAllocCount++;
+  benchAllocBytes += (long long)size;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  benchAllocCount++;
+  benchAllocBytes += (long long)(count * size);
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  benchAllocCount++;
+  benchAllocBytes += (long long)size;
+  return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+  __real_free(ptr);
+}
+#endif
+
+/// How the rects are sorted before a run, as part of it. Shelves are filled
+/// by decreasing height, the height a rect has on its shelf, as the editor
+/// does for the streaming engine.
+enum benchPresort {
+  benchPresortNone,
+  benchPresortArea,
+  benchPresortHeight
+};
+
+/// One engine with one heuristic, behind the same bin calls.
+typedef struct benchEngine {
+  const char *name;
+  void *(*create)(int width, int height, int method, int allowRotations);
+  void (*destroy)(void *bin);
+  int (*insert)(void *bin, int rectCount, maxRectsSize *rects,
+      const int *ids, maxRectsPosition *layoutResults);
+  int method;
+  enum benchPresort presort;
+} benchEngine;
+
+static void *maxRectsCreate(int width, int height, int method,
+    int allowRotations) {
+  return maxRectsBinCreate(width, height,
+      (enum maxRectsFreeRectChoiceHeuristic)method, allowRotations);
+}
+
+static void *maxRectsOnlineCreate(int width, int height, int method,
+    int allowRotations) {
+  maxRectsBin *bin = maxRectsBinCreate(width, height,
+      (enum maxRectsFreeRectChoiceHeuristic)method, allowRotations);
+  if (bin) {
+    maxRectsBinSetOnline(bin, 1);
+  }
+  return bin;
+}
+
+static void maxRectsDestroy(void *bin) {
+  maxRectsBinDestroy((maxRectsBin *)bin);
+}
+
+static int maxRectsInsert(void *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  return maxRectsBinInsert((maxRectsBin *)bin, rectCount, rects, ids,
+      layoutResults);
+}
+
+static void *skylineCreate(int width, int height, int method,
+    int allowRotations) {
+  return skylineBinCreate(width, height, (enum skylineHeuristic)method,
+      allowRotations);
+}
+
+static void skylineDestroy(void *bin) {
+  skylineBinDestroy((skylineBin *)bin);
+}
+
+static int skylineInsert(void *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  return skylineBinInsert((skylineBin *)bin, rectCount, rects, ids,
+      layoutResults);
+}
+
+// Guillotine methods hold the free rect choice in the low bits and the split
+// above them, free rects are always merged as in the editor's default.
+static void *guillotineCreate(int width, int height, int method,
+    int allowRotations) {
+  return guillotineBinCreate(width, height,
+      (enum guillotineFreeRectChoiceHeuristic)(method & 3),
+      (enum guillotineSplitHeuristic)(method >> 2), 1, allowRotations);
+}
+
+static void guillotineDestroy(void *bin) {
+  guillotineBinDestroy((guillotineBin *)bin);
+}
+
+static int guillotineInsert(void *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  return guillotineBinInsert((guillotineBin *)bin, rectCount, rects, ids,
+      layoutResults);
+}
+
+static void *shelfCreate(int width, int height, int method,
+    int allowRotations) {
+  (void)method;
+  return shelfBinCreate(width, height, allowRotations);
+}
+
+static void shelfDestroy(void *bin) {
+  shelfBinDestroy((shelfBin *)bin);
+}
+
+static int shelfInsert(void *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  return shelfBinInsert((shelfBin *)bin, rectCount, rects, ids,
+      layoutResults);
+}
+
+#define MAX_RECTS_ENGINE(name, method) \
+  { name, maxRectsCreate, maxRectsDestroy, maxRectsInsert, method, \
+    benchPresortNone }
+#define MAX_RECTS_ONLINE_ENGINE(name, method) \
+  { name, maxRectsOnlineCreate, maxRectsDestroy, maxRectsInsert, method, \
+    benchPresortArea }
+#define SKYLINE_ENGINE(name, method) \
+  { name, skylineCreate, skylineDestroy, skylineInsert, method, \
+    benchPresortNone }
+#define GUILLOTINE_ENGINE(name, choice, split) \
+  { name, guillotineCreate, guillotineDestroy, guillotineInsert, \
+    (choice) | (split) << 2, benchPresortNone }
+
+static const benchEngine benchEngines[] = {
+  MAX_RECTS_ENGINE("maxrects-BSSF", rectBestShortSideFit),
+  MAX_RECTS_ENGINE("maxrects-BLSF", rectBestLongSideFit),
+  MAX_RECTS_ENGINE("maxrects-BAF", rectBestAreaFit),
+  MAX_RECTS_ENGINE("maxrects-BL", rectBottomLeftRule),
+  MAX_RECTS_ENGINE("maxrects-CP", rectContactPointRule),
+  MAX_RECTS_ONLINE_ENGINE("maxrects-online-BSSF", rectBestShortSideFit),
+  MAX_RECTS_ONLINE_ENGINE("maxrects-online-BLSF", rectBestLongSideFit),
+  MAX_RECTS_ONLINE_ENGINE("maxrects-online-BAF", rectBestAreaFit),
+  MAX_RECTS_ONLINE_ENGINE("maxrects-online-BL", rectBottomLeftRule),
+  MAX_RECTS_ONLINE_ENGINE("maxrects-online-CP", rectContactPointRule),
+  SKYLINE_ENGINE("skyline-BL", skylineBottomLeft),
+  SKYLINE_ENGINE("skyline-BF", skylineBestFit),
+  GUILLOTINE_ENGINE("guillotine-BAF-SLAS", guillotineBestAreaFit,
+      guillotineSplitShorterLeftoverAxis),
+  GUILLOTINE_ENGINE("guillotine-BAF-LLAS", guillotineBestAreaFit,
+      guillotineSplitLongerLeftoverAxis),
+  GUILLOTINE_ENGINE("guillotine-BSSF-SLAS", guillotineBestShortSideFit,
+      guillotineSplitShorterLeftoverAxis),
+  GUILLOTINE_ENGINE("guillotine-BSSF-LLAS", guillotineBestShortSideFit,
+      guillotineSplitLongerLeftoverAxis),
+  GUILLOTINE_ENGINE("guillotine-BLSF-SLAS", guillotineBestLongSideFit,
+      guillotineSplitShorterLeftoverAxis),
+  GUILLOTINE_ENGINE("guillotine-BLSF-LLAS", guillotineBestLongSideFit,
+      guillotineSplitLongerLeftoverAxis),
+  { "shelf", shelfCreate, shelfDestroy, shelfInsert, 0, benchPresortHeight },
+};
+
+#define BENCH_ENGINE_COUNT \
+  ((int)(sizeof(benchEngines) / sizeof(benchEngines[0])))
+
+typedef struct benchCorpus {
+  char name[64];
+  int count;
+  maxRectsSize *rects;
+} benchCorpus;
+
+typedef struct benchResult {
+  double milliseconds; ///< Fastest of all repeats.
+  long long allocCount; ///< Per run, the few buffers of the run included.
+  long long allocBytes;
+  float occupancy; ///< Placed area over the area of all pages.
+  int pages;
+  int unplaced; ///< Rects larger than a page.
+} benchResult;
+
+static double benchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+// xorshift32, so every platform generates the same corpora from a seed.
+static unsigned benchRandom(unsigned *state) {
+  unsigned x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static int benchRange(unsigned *state, int lo, int hi) {
+  return lo + (int)(benchRandom(state) % (unsigned)(hi - lo + 1));
+}
+
+static double benchUnit(unsigned *state) {
+  return ((double)(benchRandom(state) >> 8) + 0.5) / 16777216.0;
+}
+
+// Pareto distributed side, most sprites small and a few large ones.
+static int benchPowerLaw(unsigned *state, int lo, int hi) {
+  const double side = lo / pow(benchUnit(state), 1.0 / 1.2);
+  return side > hi ? hi : (int)side;
+}
+
+enum benchDistribution {
+  benchUniform,
+  benchPowerLawSizes,
+  benchDuplicates,
+  benchLongThin,
+  benchDistributionCount
+};
+
+static const char *benchDistributionNames[benchDistributionCount] = {
+  "uniform", "power-law", "duplicates", "long-thin"
+};
+
+static int generateCorpus(benchCorpus *corpus, enum benchDistribution kind,
+    int count, unsigned seed) {
+  maxRectsSize palette[12];
+  unsigned state = seed ? seed : 1;
+  int i;
+
+  corpus->rects = (maxRectsSize *)malloc(sizeof(maxRectsSize) * count);
+  if (!corpus->rects) {
+    fprintf(stderr, "%s: malloc failed\n", __FUNCTION__);
+    return -1;
+  }
+  corpus->count = count;
+  snprintf(corpus->name, sizeof(corpus->name), "%s",
+      benchDistributionNames[kind]);
+
+  for (i = 0; i < (int)(sizeof(palette) / sizeof(palette[0])); i++) {
+    palette[i].width = benchRange(&state, 8, 96);
+    palette[i].height = benchRange(&state, 8, 96);
+  }
+
+  for (i = 0; i < count; i++) {
+    maxRectsSize *rc = &corpus->rects[i];
+    switch (kind) {
+      case benchUniform:
+        rc->width = benchRange(&state, 4, 128);
+        rc->height = benchRange(&state, 4, 128);
+        break;
+      case benchPowerLawSizes:
+        rc->width = benchPowerLaw(&state, 4, 512);
+        rc->height = benchPowerLaw(&state, 4, 512);
+        break;
+      case benchDuplicates:
+        // Tiles and glyphs: a handful of sizes, a few odd ones in between.
+        if (benchRange(&state, 0, 9)) {
+          *rc = palette[benchRange(&state, 0, 11)];
+        } else {
+          rc->width = benchRange(&state, 4, 128);
+          rc->height = benchRange(&state, 4, 128);
+        }
+        break;
+      default:
+        // Bars, borders and strips, lying or standing.
+        rc->width = benchRange(&state, 2, 16);
+        rc->height = benchRange(&state, 64, 512);
+        if (benchRandom(&state) & 1) {
+          int t = rc->width;
+          rc->width = rc->height;
+          rc->height = t;
+        }
+        break;
+    }
+  }
+  return 0;
+}
+
+static int loadCorpus(benchCorpus *corpus, const char *path) {
+  FILE *f = fopen(path, "r");
+  const char *base = strrchr(path, '/');
+  char line[256];
+  int capacity = 0;
+
+  memset(corpus, 0, sizeof(*corpus));
+  if (!f) {
+    fprintf(stderr, "%s: cannot open %s\n", __FUNCTION__, path);
+    return -1;
+  }
+  snprintf(corpus->name, sizeof(corpus->name), "%s", base ? base + 1 : path);
+
+  while (fgets(line, sizeof(line), f)) {
+    int width, height;
+    if (line[0] == '#' || sscanf(line, "%d %d", &width, &height) != 2) {
+      continue;
+    }
+    if (width <= 0 || height <= 0) {
+      continue;
+    }
+    if (corpus->count == capacity) {
+      maxRectsSize *rects;
+      capacity = capacity ? capacity * 2 : 256;
+      rects = (maxRectsSize *)realloc(corpus->rects,
+          sizeof(maxRectsSize) * capacity);
+      if (!rects) {
+        fprintf(stderr, "%s: realloc failed\n", __FUNCTION__);
+        free(corpus->rects);
+        fclose(f);
+        return -1;
+      }
+      corpus->rects = rects;
+    }
+    corpus->rects[corpus->count].width = width;
+    corpus->rects[corpus->count].height = height;
+    corpus->count++;
+  }
+  fclose(f);
+
+  if (!corpus->count) {
+    fprintf(stderr, "%s: no sizes in %s\n", __FUNCTION__, path);
+    free(corpus->rects);
+    return -1;
+  }
+  return 0;
+}
+
+static int compareArea(const void *a, const void *b) {
+  const maxRectsSize *ra = (const maxRectsSize *)a;
+  const maxRectsSize *rb = (const maxRectsSize *)b;
+  long long areaA = (long long)ra->width * ra->height;
+  long long areaB = (long long)rb->width * rb->height;
+  return areaA < areaB ? 1 : areaA > areaB ? -1 : 0;
+}
+
+// Page width and rotation of the run for compareShelfHeight, qsort has no
+// context argument.
+static int benchSortWidth;
+static int benchSortRotations;
+
+static int shelfHeight(const maxRectsSize *rc) {
+  const int lying = rc->width < rc->height ? rc->width : rc->height;
+  const int standing = rc->width < rc->height ? rc->height : rc->width;
+  return benchSortRotations && standing <= benchSortWidth ? lying
+      : rc->height;
+}
+
+/// By decreasing shelf height, then by size so equal heights sort the same
+/// on every platform.
+static int compareShelfHeight(const void *a, const void *b) {
+  const maxRectsSize *ra = (const maxRectsSize *)a;
+  const maxRectsSize *rb = (const maxRectsSize *)b;
+  int ha = shelfHeight(ra);
+  int hb = shelfHeight(rb);
+  if (ha != hb) {
+    return ha < hb ? 1 : -1;
+  }
+  if (ra->width != rb->width) {
+    return ra->width < rb->width ? 1 : -1;
+  }
+  return ra->height < rb->height ? 1 : ra->height > rb->height ? -1 : 0;
+}
+
+/// Packs the corpus onto as many pages as it takes, each a fresh bin that
+/// gets the rects the pages before it left over, as the editor does.
+static int runEngine(const benchEngine *engine, const benchCorpus *corpus,
+    int width, int height, int allowRotations, benchResult *result) {
+  const int count = corpus->count;
+  maxRectsSize *rects = (maxRectsSize *)malloc(sizeof(maxRectsSize) * count);
+  maxRectsPosition *results =
+      (maxRectsPosition *)malloc(sizeof(maxRectsPosition) * count);
+  int *ids = (int *)malloc(sizeof(int) * count);
+  void **bins = NULL;
+  int binCapacity = 0;
+  int remaining = count;
+  long long placedArea = 0;
+  int i, ret = 0;
+
+  memset(result, 0, sizeof(*result));
+  if (!rects || !results || !ids) {
+    fprintf(stderr, "%s: malloc failed\n", __FUNCTION__);
+    ret = -1;
+    goto done;
+  }
+  memcpy(rects, corpus->rects, sizeof(maxRectsSize) * count);
+  if (engine->presort == benchPresortArea) {
+    qsort(rects, count, sizeof(maxRectsSize), compareArea);
+  } else if (engine->presort == benchPresortHeight) {
+    benchSortWidth = width;
+    benchSortRotations = allowRotations;
+    qsort(rects, count, sizeof(maxRectsSize), compareShelfHeight);
+  }
+  for (i = 0; i < count; i++) {
+    ids[i] = i;
+  }
+
+  while (remaining > 0) {
+    void *bin;
+    int kept = 0;
+
+    if (result->pages == binCapacity) {
+      void **grown;
+      binCapacity = binCapacity ? binCapacity * 2 : 8;
+      grown = (void **)realloc(bins, sizeof(void *) * binCapacity);
+      if (!grown) {
+        fprintf(stderr, "%s: realloc failed\n", __FUNCTION__);
+        ret = -1;
+        goto done;
+      }
+      bins = grown;
+    }
+    bin = engine->create(width, height, engine->method, allowRotations);
+    if (!bin) {
+      ret = -1;
+      goto done;
+    }
+    bins[result->pages++] = bin;
+
+    memset(results, 0, sizeof(maxRectsPosition) * remaining);
+    engine->insert(bin, remaining, rects, ids, results);
+    for (i = 0; i < remaining; i++) {
+      if (results[i].used) {
+        placedArea += (long long)rects[i].width * rects[i].height;
+      } else {
+        rects[kept] = rects[i];
+        ids[kept] = ids[i];
+        kept++;
+      }
+    }
+
+    // Nothing went onto an empty page, so the rest is larger than a page.
+    if (kept == remaining) {
+      result->pages--;
+      engine->destroy(bin);
+      result->unplaced = kept;
+      break;
+    }
+    remaining = kept;
+  }
+
+  if (result->pages) {
+    result->occupancy = (float)((double)placedArea /
+        ((double)width * height * result->pages));
+  }
+
+done:
+  for (i = 0; i < result->pages; i++) {
+    engine->destroy(bins[i]);
+  }
+  free(bins);
+  free(ids);
+  free(results);
+  free(rects);
+  return ret;
+}
+
+static int overlapsSpot(const maxRectsSize *size,
+    const maxRectsPosition *spot, int x, int y, int width, int height) {
+  const int w = spot->rotated ? size->height : size->width;
+  const int h = spot->rotated ? size->width : size->height;
+  return x < spot->left + w && spot->left < x + width &&
+      y < spot->top + h && spot->top < y + height;
+}
+
+/// Removing every rect from a maxrects bin must give the whole page back,
+/// and any spot no rect covers must take a rect, whatever was inserted and
+/// removed before.
+static int checkRemove(void) {
+  enum { steps = 400, capacity = 64 };
+  maxRectsSize sizes[capacity];
+  maxRectsPosition spots[capacity];
+  int ids[capacity];
+  int failures = 0;
+  int method;
+
+  for (method = rectBestShortSideFit; method <= rectContactPointRule;
+      method++) {
+    maxRectsBin *bin = maxRectsBinCreate(100, 100,
+        (enum maxRectsFreeRectChoiceHeuristic)method, 0);
+    maxRectsSize rects[2] = { { 30, 30 }, { 20, 50 } };
+    maxRectsSize page = { 100, 100 };
+    maxRectsPosition results[2];
+    unsigned state = 7;
+    int count = 0, nextId = 1, step, probe, i;
+
+    if (!bin) {
+      return -1;
+    }
+    memset(results, 0, sizeof(results));
+    maxRectsBinInsert(bin, 2, rects, NULL, results);
+    maxRectsBinRemove(bin, 0);
+    maxRectsBinRemove(bin, 1);
+    if (maxRectsBinInsert(bin, 1, &page, NULL, results) != 0) {
+      printf("method %d: a full page does not fit an emptied bin\n", method);
+      failures++;
+    }
+
+    maxRectsBinReset(bin, 256, 256,
+        (enum maxRectsFreeRectChoiceHeuristic)method, 1);
+    for (step = 0; step < steps; step++) {
+      if (count < capacity && (count == 0 || benchRange(&state, 0, 2))) {
+        maxRectsPosition spot = { 0 };
+        sizes[count].width = benchRange(&state, 4, 32);
+        sizes[count].height = benchRange(&state, 4, 32);
+        ids[count] = nextId++;
+        if (maxRectsBinInsert(bin, 1, &sizes[count], &ids[count],
+              &spot) == 0) {
+          spots[count++] = spot;
+        }
+        continue;
+      }
+      i = benchRange(&state, 0, count - 1);
+      maxRectsBinRemove(bin, ids[i]);
+      sizes[i] = sizes[--count];
+      spots[i] = spots[count];
+      ids[i] = ids[count];
+
+      // Some spot of the free space left, probed at random.
+      for (probe = 0; probe < 64; probe++) {
+        maxRectsSize size;
+        maxRectsPosition spot = { 0 };
+        int j;
+        size.width = benchRange(&state, 1, 48);
+        size.height = benchRange(&state, 1, 48);
+        spot.left = benchRange(&state, 0, 256 - size.width);
+        spot.top = benchRange(&state, 0, 256 - size.height);
+        for (j = 0; j < count; j++) {
+          if (overlapsSpot(&sizes[j], &spots[j], spot.left, spot.top,
+                size.width, size.height)) {
+            break;
+          }
+        }
+        if (j < count) {
+          continue;
+        }
+        if (maxRectsBinPlace(bin, &size, &spot, nextId) != 0) {
+          printf("method %d: a free spot does not take a rect\n", method);
+          failures++;
+          step = steps;
+        }
+        maxRectsBinRemove(bin, nextId);
+        break;
+      }
+    }
+    for (i = 0; i < count; i++) {
+      maxRectsBinRemove(bin, ids[i]);
+    }
+    page.width = page.height = 256;
+    if (maxRectsBinInsert(bin, 1, &page, NULL, results) != 0) {
+      printf("method %d: a full page does not fit after %d steps\n", method,
+          steps);
+      failures++;
+    }
+    maxRectsBinDestroy(bin);
+  }
+  printf("remove check: %s\n", failures ? "failed" : "passed");
+  return failures ? 1 : 0;
+}
+
+static void usage(const char *exe) {
+  printf("usage: %s [options] [size files...]\n"
+         "Packs generated sprite sizes, or the size lists given, with every\n"
+         "engine and heuristic.\n"
+         "  -n count    rects per generated corpus (2000)\n"
+         "  -p WxH      page size (1024x1024)\n"
+         "  -r repeat   runs per engine, the fastest is reported (3)\n"
+         "  -s seed     seed of the generated corpora (1)\n"
+         "  -e name     only engines whose name starts with name\n"
+         "  -g          generated corpora too when size files are given\n"
+         "  -R          allow rotation\n"
+         "  -t          only check that removed space is given back\n", exe);
+}
+
+int main(int argc, char **argv) {
+  benchCorpus corpora[benchDistributionCount + 64];
+  int corpusCount = 0;
+  int count = 2000, width = 1024, height = 1024, repeat = 3;
+  int allowRotations = 0, generated = 0, files = 0;
+  unsigned seed = 1;
+  const char *only = NULL;
+  int i, c, e, r;
+
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(arg, "-n") && value) {
+      count = atoi(value);
+      i++;
+    } else if (!strcmp(arg, "-p") && value) {
+      if (sscanf(value, "%dx%d", &width, &height) != 2) {
+        usage(argv[0]);
+        return 1;
+      }
+      i++;
+    } else if (!strcmp(arg, "-r") && value) {
+      repeat = atoi(value);
+      i++;
+    } else if (!strcmp(arg, "-s") && value) {
+      seed = (unsigned)strtoul(value, NULL, 10);
+      i++;
+    } else if (!strcmp(arg, "-e") && value) {
+      only = value;
+      i++;
+    } else if (!strcmp(arg, "-g")) {
+      generated = 1;
+    } else if (!strcmp(arg, "-R")) {
+      allowRotations = 1;
+    } else if (!strcmp(arg, "-t")) {
+      return checkRemove();
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return arg[1] == 'h' ? 0 : 1;
+    } else if (corpusCount < (int)(sizeof(corpora) / sizeof(corpora[0]))) {
+      if (loadCorpus(&corpora[corpusCount], arg) == 0) {
+        corpusCount++;
+      }
+      files = 1;
+    }
+  }
+  if (count <= 0 || width <= 0 || height <= 0 || repeat <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!files || generated) {
+    for (i = 0; i < benchDistributionCount; i++) {
+      if (generateCorpus(&corpora[corpusCount],
+            (enum benchDistribution)i, count, seed) != 0) {
+        return 1;
+      }
+      corpusCount++;
+    }
+  }
+
+  printf("%-20s %-22s %7s %10s %9s %10s %9s %6s %8s\n", "corpus", "engine",
+      "rects", "ms", "allocs", "alloc KB", "occupancy", "pages", "unplaced");
+  for (c = 0; c < corpusCount; c++) {
+    for (e = 0; e < BENCH_ENGINE_COUNT; e++) {
+      const benchEngine *engine = &benchEngines[e];
+      benchResult best;
+
+      if (only && strncmp(engine->name, only, strlen(only))) {
+        continue;
+      }
+
+      for (r = 0; r < repeat; r++) {
+        benchResult run;
+        double start;
+        benchAllocCount = benchAllocBytes = 0;
+        start = benchNow();
+        if (runEngine(engine, &corpora[c], width, height, allowRotations,
+              &run) != 0) {
+          return 1;
+        }
+        run.milliseconds = benchNow() - start;
+        run.allocCount = benchAllocCount;
+        run.allocBytes = benchAllocBytes;
+        if (r == 0 || run.milliseconds < best.milliseconds) {
+          best = run;
+        }
+      }
+
+#ifdef BENCH_WRAP_MALLOC
+      printf("%-20s %-22s %7d %10.3f %9lld %10lld %8.1f%% %6d %8d\n",
+          corpora[c].name, engine->name, corpora[c].count, best.milliseconds,
+          best.allocCount, best.allocBytes / 1024, best.occupancy * 100.f,
+          best.pages, best.unplaced);
+#else
+      printf("%-20s %-22s %7d %10.3f %9s %10s %8.1f%% %6d %8d\n",
+          corpora[c].name, engine->name, corpora[c].count, best.milliseconds,
+          "-", "-", best.occupancy * 100.f, best.pages, best.unplaced);
+#endif
+    }
+  }
+
+  for (c = 0; c < corpusCount; c++) {
+    free(corpora[c].rects);
+  }
+  return 0;
+}
@@ -0,0 +1,429 @@
+/*
+  Guillotine bin packer, after the Public Domain GuillotineBinPack.cpp source
+  by Jukka Jylänki, https://github.com/juj/RectangleBinPack/
+*/
+#include "guillotine.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef MIN
+#undef MIN
+#endif
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#ifdef MAX
+#undef MAX
+#endif
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef struct guillotineRect {
+  int x;
+  int y;
+  int width;
+  int height;
+  int id;
+} guillotineRect;
+
+typedef struct guillotineRectArray {
+  guillotineRect *data;
+  int count;
+  int capacity;
+} guillotineRectArray;
+
+struct guillotineBin {
+  int width;
+  int height;
+  enum guillotineFreeRectChoiceHeuristic method;
+  enum guillotineSplitHeuristic split;
+  int merge;
+  int allowRotations;
+  guillotineRectArray freeRects;
+  guillotineRectArray usedRects;
+  long long usedArea;
+};
+
+static int reserveRects(guillotineRectArray *array, int capacity) {
+  guillotineRect *data;
+  if (capacity <= array->capacity) {
+    return 0;
+  }
+  capacity = MAX(capacity, array->capacity * 2);
+  data = (guillotineRect *)realloc(array->data,
+    (size_t)capacity * sizeof(guillotineRect));
+  if (!data) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  array->data = data;
+  array->capacity = capacity;
+  return 0;
+}
+
+static int pushRect(guillotineRectArray *array, const guillotineRect *rect) {
+  if (0 != reserveRects(array, array->count + 1)) {
+    return -1;
+  }
+  array->data[array->count++] = *rect;
+  return 0;
+}
+
+/// Free and used rects carry no order, so removal moves the last one into
+/// the gap.
+static void removeRectAt(guillotineRectArray *array, int index) {
+  array->data[index] = array->data[--array->count];
+}
+
+static int scoreRect(enum guillotineFreeRectChoiceHeuristic method,
+    int width, int height, const guillotineRect *freeRect) {
+  int leftoverHoriz = freeRect->width - width;
+  int leftoverVert = freeRect->height - height;
+  switch (method) {
+    case guillotineBestShortSideFit:
+      return MIN(leftoverHoriz, leftoverVert);
+    case guillotineBestLongSideFit:
+      return MAX(leftoverHoriz, leftoverVert);
+    case guillotineBestAreaFit:
+    default:
+      return freeRect->width * freeRect->height - width * height;
+  }
+}
+
+/// Returns the index of the free rect to place into, or -1. An exact fit
+/// ends the search right away.
+static int findFreeRect(guillotineBin *bin, int width, int height,
+    int *rotated) {
+  int bestScore = INT_MAX;
+  int bestIndex = -1;
+  int i;
+  for (i = 0; i < bin->freeRects.count; ++i) {
+    const guillotineRect *freeRect = &bin->freeRects.data[i];
+    int score;
+    if (width <= freeRect->width && height <= freeRect->height) {
+      if (width == freeRect->width && height == freeRect->height) {
+        *rotated = 0;
+        return i;
+      }
+      score = scoreRect(bin->method, width, height, freeRect);
+      if (score < bestScore) {
+        bestScore = score;
+        bestIndex = i;
+        *rotated = 0;
+      }
+    }
+    if (bin->allowRotations &&
+        height <= freeRect->width && width <= freeRect->height) {
+      if (height == freeRect->width && width == freeRect->height) {
+        *rotated = 1;
+        return i;
+      }
+      score = scoreRect(bin->method, height, width, freeRect);
+      if (score < bestScore) {
+        bestScore = score;
+        bestIndex = i;
+        *rotated = 1;
+      }
+    }
+  }
+  return bestIndex;
+}
+
+/// Joins the free rect at index with every free rect sharing a whole edge,
+/// until none is left.
+static void mergeFreeRect(guillotineBin *bin, int index) {
+  int i = 0;
+  while (i < bin->freeRects.count) {
+    guillotineRect *rect = &bin->freeRects.data[index];
+    const guillotineRect *other = &bin->freeRects.data[i];
+    int merged = 0;
+    if (i != index) {
+      if (rect->x == other->x && rect->width == other->width) {
+        if (rect->y + rect->height == other->y) {
+          rect->height += other->height;
+          merged = 1;
+        } else if (other->y + other->height == rect->y) {
+          rect->y = other->y;
+          rect->height += other->height;
+          merged = 1;
+        }
+      } else if (rect->y == other->y && rect->height == other->height) {
+        if (rect->x + rect->width == other->x) {
+          rect->width += other->width;
+          merged = 1;
+        } else if (other->x + other->width == rect->x) {
+          rect->x = other->x;
+          rect->width += other->width;
+          merged = 1;
+        }
+      }
+    }
+    if (!merged) {
+      ++i;
+      continue;
+    }
+    // The grown rect may now line up with rects already passed.
+    if (index == bin->freeRects.count - 1) {
+      index = i;
+    }
+    removeRectAt(&bin->freeRects, i);
+    i = 0;
+  }
+}
+
+/// Cuts the rest of freeRect around placed, which sits in its top left
+/// corner, into at most two new free rects.
+static int splitFreeRect(guillotineBin *bin, const guillotineRect *freeRect,
+    const guillotineRect *placed) {
+  int leftoverHoriz = freeRect->width - placed->width;
+  int leftoverVert = freeRect->height - placed->height;
+  int splitHorizontal;
+  guillotineRect bottom;
+  guillotineRect right;
+
+  if (guillotineSplitLongerLeftoverAxis == bin->split) {
+    splitHorizontal = leftoverHoriz > leftoverVert;
+  } else {
+    splitHorizontal = leftoverHoriz <= leftoverVert;
+  }
+
+  bottom.x = freeRect->x;
+  bottom.y = freeRect->y + placed->height;
+  bottom.height = leftoverVert;
+  bottom.id = 0;
+  right.x = freeRect->x + placed->width;
+  right.y = freeRect->y;
+  right.width = leftoverHoriz;
+  right.id = 0;
+  if (splitHorizontal) {
+    bottom.width = freeRect->width;
+    right.height = placed->height;
+  } else {
+    bottom.width = placed->width;
+    right.height = freeRect->height;
+  }
+
+  if (bottom.width > 0 && bottom.height > 0) {
+    if (0 != pushRect(&bin->freeRects, &bottom)) {
+      return -1;
+    }
+    if (bin->merge) {
+      mergeFreeRect(bin, bin->freeRects.count - 1);
+    }
+  }
+  if (right.width > 0 && right.height > 0) {
+    if (0 != pushRect(&bin->freeRects, &right)) {
+      return -1;
+    }
+    if (bin->merge) {
+      mergeFreeRect(bin, bin->freeRects.count - 1);
+    }
+  }
+  return 0;
+}
+
+guillotineBin *guillotineBinCreate(int width, int height,
+    enum guillotineFreeRectChoiceHeuristic method,
+    enum guillotineSplitHeuristic split, int merge, int allowRotations) {
+  guillotineBin *bin = (guillotineBin *)calloc(1, sizeof(guillotineBin));
+  if (!bin) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  if (0 != guillotineBinReset(bin, width, height, method, split, merge,
+      allowRotations)) {
+    guillotineBinDestroy(bin);
+    return 0;
+  }
+  return bin;
+}
+
+void guillotineBinDestroy(guillotineBin *bin) {
+  if (!bin) {
+    return;
+  }
+  free(bin->freeRects.data);
+  free(bin->usedRects.data);
+  free(bin);
+}
+
+int guillotineBinReset(guillotineBin *bin, int width, int height,
+    enum guillotineFreeRectChoiceHeuristic method,
+    enum guillotineSplitHeuristic split, int merge, int allowRotations) {
+  guillotineRect whole;
+  bin->width = width;
+  bin->height = height;
+  bin->method = method;
+  bin->split = split;
+  bin->merge = merge;
+  bin->allowRotations = allowRotations;
+  bin->freeRects.count = 0;
+  bin->usedRects.count = 0;
+  bin->usedArea = 0;
+  whole.x = 0;
+  whole.y = 0;
+  whole.width = width;
+  whole.height = height;
+  whole.id = 0;
+  return pushRect(&bin->freeRects, &whole);
+}
+
+int guillotineBinInsert(guillotineBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  int failed = 0;
+  int i;
+  if (0 != reserveRects(&bin->usedRects, bin->usedRects.count + rectCount)) {
+    return -1;
+  }
+  for (i = 0; i < rectCount; ++i) {
+    guillotineRect freeRect;
+    guillotineRect placed;
+    int rotated = 0;
+    int index = findFreeRect(bin, rects[i].width, rects[i].height, &rotated);
+    if (index < 0) {
+      failed = 1;
+      continue;
+    }
+
+    freeRect = bin->freeRects.data[index];
+    placed.x = freeRect.x;
+    placed.y = freeRect.y;
+    placed.width = rotated ? rects[i].height : rects[i].width;
+    placed.height = rotated ? rects[i].width : rects[i].height;
+    placed.id = ids ? ids[i] : i;
+    removeRectAt(&bin->freeRects, index);
+    if (0 != splitFreeRect(bin, &freeRect, &placed)) {
+      return -1;
+    }
+
+    bin->usedRects.data[bin->usedRects.count++] = placed;
+    bin->usedArea += (long long)placed.width * placed.height;
+    layoutResults[i].left = placed.x;
+    layoutResults[i].top = placed.y;
+    layoutResults[i].rotated = rotated;
+    layoutResults[i].used = 1;
+  }
+  return failed ? -1 : 0;
+}
+
+int guillotineBinRemove(guillotineBin *bin, int id) {
+  guillotineRect freed;
+  int i;
+  for (i = 0; i < bin->usedRects.count; ++i) {
+    if (bin->usedRects.data[i].id == id) {
+      break;
+    }
+  }
+  if (i == bin->usedRects.count) {
+    return -1;
+  }
+  freed = bin->usedRects.data[i];
+  freed.id = 0;
+  removeRectAt(&bin->usedRects, i);
+  bin->usedArea -= (long long)freed.width * freed.height;
+
+  // Used and free rects never overlap, so the freed rect is a valid free
+  // rect as it is.
+  if (0 != pushRect(&bin->freeRects, &freed)) {
+    return -1;
+  }
+  if (bin->merge) {
+    mergeFreeRect(bin, bin->freeRects.count - 1);
+  }
+  return 0;
+}
+
+int guillotineBinPlace(guillotineBin *bin, const maxRectsSize *size,
+    const maxRectsPosition *position, int id) {
+  guillotineRect placed;
+  long long covered = 0;
+  int i;
+  placed.x = position->left;
+  placed.y = position->top;
+  placed.width = position->rotated ? size->height : size->width;
+  placed.height = position->rotated ? size->width : size->height;
+  placed.id = id;
+  if (placed.width <= 0 || placed.height <= 0 || placed.x < 0 ||
+      placed.y < 0 || placed.x + placed.width > bin->width ||
+      placed.y + placed.height > bin->height) {
+    return -1;
+  }
+
+  // Free rects are disjoint, so the spot is free when they cover all of it.
+  for (i = 0; i < bin->freeRects.count; ++i) {
+    const guillotineRect *freeRect = &bin->freeRects.data[i];
+    int width = MIN(freeRect->x + freeRect->width, placed.x + placed.width) -
+      MAX(freeRect->x, placed.x);
+    int height = MIN(freeRect->y + freeRect->height,
+      placed.y + placed.height) - MAX(freeRect->y, placed.y);
+    if (width > 0 && height > 0) {
+      covered += (long long)width * height;
+    }
+  }
+  if (covered != (long long)placed.width * placed.height) {
+    return -1;
+  }
+  if (0 != reserveRects(&bin->usedRects, bin->usedRects.count + 1)) {
+    return -1;
+  }
+
+  // Every free rect the spot cuts leaves a band above and below it and a
+  // piece to either side in between. Walking from the back, whatever
+  // removeRectAt() moves into the gap was looked at already.
+  for (i = bin->freeRects.count - 1; i >= 0; --i) {
+    guillotineRect freeRect = bin->freeRects.data[i];
+    guillotineRect piece;
+    int top = MAX(freeRect.y, placed.y);
+    int bottom = MIN(freeRect.y + freeRect.height, placed.y + placed.height);
+    if (placed.x >= freeRect.x + freeRect.width ||
+        placed.x + placed.width <= freeRect.x || top >= bottom) {
+      continue;
+    }
+    removeRectAt(&bin->freeRects, i);
+    piece.id = 0;
+    if (freeRect.y < top) {
+      piece.x = freeRect.x;
+      piece.y = freeRect.y;
+      piece.width = freeRect.width;
+      piece.height = top - freeRect.y;
+      if (0 != pushRect(&bin->freeRects, &piece)) {
+        return -1;
+      }
+    }
+    if (bottom < freeRect.y + freeRect.height) {
+      piece.x = freeRect.x;
+      piece.y = bottom;
+      piece.width = freeRect.width;
+      piece.height = freeRect.y + freeRect.height - bottom;
+      if (0 != pushRect(&bin->freeRects, &piece)) {
+        return -1;
+      }
+    }
+    if (freeRect.x < placed.x) {
+      piece.x = freeRect.x;
+      piece.y = top;
+      piece.width = placed.x - freeRect.x;
+      piece.height = bottom - top;
+      if (0 != pushRect(&bin->freeRects, &piece)) {
+        return -1;
+      }
+    }
+    if (placed.x + placed.width < freeRect.x + freeRect.width) {
+      piece.x = placed.x + placed.width;
+      piece.y = top;
+      piece.width = freeRect.x + freeRect.width - piece.x;
+      piece.height = bottom - top;
+      if (0 != pushRect(&bin->freeRects, &piece)) {
+        return -1;
+      }
+    }
+  }
+
+  bin->usedRects.data[bin->usedRects.count++] = placed;
+  bin->usedArea += (long long)placed.width * placed.height;
+  return 0;
+}
+
+float guillotineBinOccupancy(guillotineBin *bin) {
+  return (float)((double)bin->usedArea /
+    ((double)bin->width * bin->height));
+}
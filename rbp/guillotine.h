@@ -0,0 +1,56 @@
+/*
+  Guillotine bin packer, after the Public Domain GuillotineBinPack.cpp source
+  by Jukka Jylänki, https://github.com/juj/RectangleBinPack/
+  Uses the same size and position types as maxrects.h.
+*/
+
+#ifndef GUILLOTINE_H
+#define GUILLOTINE_H
+
+#include "maxrects.h"
+
+enum guillotineFreeRectChoiceHeuristic {
+  guillotineBestAreaFit, ///< -BAF: Picks the smallest free rect the rect fits into.
+  guillotineBestShortSideFit, ///< -BSSF: Picks the free rect with the smallest leftover along the short side.
+  guillotineBestLongSideFit ///< -BLSF: Picks the free rect with the smallest leftover along the long side.
+};
+
+enum guillotineSplitHeuristic {
+  guillotineSplitShorterLeftoverAxis, ///< -SLAS: Cuts along the axis with less space left over.
+  guillotineSplitLongerLeftoverAxis ///< -LLAS: Cuts along the axis with more space left over.
+};
+
+/// A bin whose free space is a list of disjoint rects, each placement cutting
+/// one of them in two. Removed rects go straight back to the free list.
+typedef struct guillotineBin guillotineBin;
+
+guillotineBin *guillotineBinCreate(int width, int height,
+    enum guillotineFreeRectChoiceHeuristic method,
+    enum guillotineSplitHeuristic split, int merge, int allowRotations);
+void guillotineBinDestroy(guillotineBin *bin);
+
+/// Empties the bin and applies new settings. With merge set, free rects
+/// sharing a whole edge are joined after every cut.
+int guillotineBinReset(guillotineBin *bin, int width, int height,
+    enum guillotineFreeRectChoiceHeuristic method,
+    enum guillotineSplitHeuristic split, int merge, int allowRotations);
+
+/// Places rects in the given order. ids (may be null, then the index is used)
+/// are remembered for guillotineBinRemove(). Only the entries of
+/// layoutResults that were placed are written. Returns -1 when some rects did
+/// not fit.
+int guillotineBinInsert(guillotineBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults);
+
+/// Gives the space of a previously inserted rect back to the bin.
+int guillotineBinRemove(guillotineBin *bin, int id);
+
+/// Puts a rect of the given size at position, cutting the free rects it
+/// covers, so a layout can be rebuilt. Returns -1 when the spot is not
+/// entirely free.
+int guillotineBinPlace(guillotineBin *bin, const maxRectsSize *size,
+    const maxRectsPosition *position, int id);
+
+float guillotineBinOccupancy(guillotineBin *bin);
+
+#endif
@@ -25,20 +25,197 @@
 #endif
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+// Marks a free rect that was split or pruned and waits for compaction.
+#define REMOVED_RECT_ORDER INT_MIN
+
+// Scoring a step goes to the parallel for once it compares at least
+// MAX_RECTS_PARALLEL_WORK pairs of input and free rect, in up to
+// MAX_RECTS_SLICES slices of at least MAX_RECTS_SLICE_INPUTS inputs. Below
+// that, handing the slices out costs more than it saves.
+#define MAX_RECTS_PARALLEL_WORK 16384
+#define MAX_RECTS_SLICES 64
+#define MAX_RECTS_SLICE_INPUTS 16
+
+// Free rects are scored MAX_RECTS_LANES at a time with AVX2 or SSE4.1 when
+// the compiler targets them (/arch:AVX2 or /arch:AVX on MSVC, which has no
+// SSE4.1 switch), one at a time otherwise.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MAX_RECTS_LANES_SIMD
+#define MAX_RECTS_LANES 8
+typedef __m256i laneVec;
+#define vload(p) _mm256_load_si256((const __m256i *)(p))
+#define vstore(p, v) _mm256_store_si256((__m256i *)(p), v)
+#define vset1(v) _mm256_set1_epi32(v)
+#define vlaneIndex() _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)
+#define vadd(a, b) _mm256_add_epi32(a, b)
+#define vsub(a, b) _mm256_sub_epi32(a, b)
+#define vmul(a, b) _mm256_mullo_epi32(a, b)
+#define vmin(a, b) _mm256_min_epi32(a, b)
+#define vmax(a, b) _mm256_max_epi32(a, b)
+#define vgt(a, b) _mm256_cmpgt_epi32(a, b)
+#define veq(a, b) _mm256_cmpeq_epi32(a, b)
+#define vand(a, b) _mm256_and_si256(a, b)
+#define vor(a, b) _mm256_or_si256(a, b)
+#define vandnot(a, b) _mm256_andnot_si256(a, b)
+#define vblend(a, b, mask) _mm256_blendv_epi8(a, b, mask)
+#elif defined(__SSE4_1__) || defined(__AVX__)
+#include <smmintrin.h>
+#define MAX_RECTS_LANES_SIMD
+#define MAX_RECTS_LANES 4
+typedef __m128i laneVec;
+#define vload(p) _mm_load_si128((const __m128i *)(p))
+#define vstore(p, v) _mm_store_si128((__m128i *)(p), v)
+#define vset1(v) _mm_set1_epi32(v)
+#define vlaneIndex() _mm_setr_epi32(0, 1, 2, 3)
+#define vadd(a, b) _mm_add_epi32(a, b)
+#define vsub(a, b) _mm_sub_epi32(a, b)
+#define vmul(a, b) _mm_mullo_epi32(a, b)
+#define vmin(a, b) _mm_min_epi32(a, b)
+#define vmax(a, b) _mm_max_epi32(a, b)
+#define vgt(a, b) _mm_cmpgt_epi32(a, b)
+#define veq(a, b) _mm_cmpeq_epi32(a, b)
+#define vand(a, b) _mm_and_si128(a, b)
+#define vor(a, b) _mm_or_si128(a, b)
+#define vandnot(a, b) _mm_andnot_si128(a, b)
+#define vblend(a, b, mask) _mm_blendv_epi8(a, b, mask)
+#else
+#define MAX_RECTS_LANES 1
+#endif
 
-  typedef struct maxRectsRect {
-  struct maxRectsRect *next;
-  struct maxRectsRect *prev;
-  int rectOrder;
+#if defined(_MSC_VER)
+#define MAX_RECTS_ALIGNED __declspec(align(32))
+#define MAX_RECTS_INLINE static __forceinline
+#else
+#define MAX_RECTS_ALIGNED __attribute__((aligned(32)))
+#define MAX_RECTS_INLINE static inline __attribute__((always_inline))
+#endif
+
+typedef struct maxRectsRect {
   int x;
   int y;
   int width;
   int height;
-  int inFreeRectLink:1;
-  int inUsedRectLink:1;
-  int inInputRectLink:1;
+  int rectOrder;
+  int id;
 } maxRectsRect;
 
+// Rects are appended to the back of an array and every scan walks it from
+// the back to the front. That is the exact order of the old doubly linked
+// lists, which prepended new nodes, so ties resolve to the same layouts.
+typedef struct maxRectsRectArray {
+  maxRectsRect *data;
+  int count;
+  int capacity;
+} maxRectsRectArray;
+
+// The free rects again as separate, 32 byte aligned x, y, width and height
+// arrays for scoring. The tail up to paddedCount holds rects no input fits.
+typedef struct maxRectsFreeLanes {
+  void *memory;
+  int *x;
+  int *y;
+  int *width;
+  int *height;
+  int count;
+  int paddedCount;
+  int capacity;
+} maxRectsFreeLanes;
+
+// Free rect indices of one grid cell, MAX_RECTS_GRID_BLOCK per block; a
+// block and its index list fill 64 bytes.
+#define MAX_RECTS_GRID_BLOCK 14
+
+typedef struct maxRectsGridBlock {
+  int next;
+  int count;
+  int indices[MAX_RECTS_GRID_BLOCK];
+} maxRectsGridBlock;
+
+// Uniform grid over the bin, every cell lists the free rects overlapping it
+// by their index in freeRects. Between rebuilds, free rects that go away
+// are only marked removed, so those indices stay put; the dead ones are
+// compacted away once they make up half of the list. The lists are chains
+// of blocks from one pool, newest block first, which only ever fills up;
+// emptied blocks go to a free list and a rebuild starts the pool over.
+typedef struct maxRectsGrid {
+  int *cells; // first block of every cell, -1 when empty
+  int cellCapacity;
+  maxRectsGridBlock *blocks;
+  int blockCount;
+  int blockCapacity;
+  int freeBlock;
+  int columns;
+  int rows;
+  int shift;
+  int deadRects;
+  int valid;
+  int *found;
+  int foundCount;
+  int foundCapacity;
+} maxRectsGrid;
+
+/// Best input of one slice of a step, or index -1 when none fits.
+typedef struct maxRectsChoice {
+  int index;
+  int score1;
+  int score2;
+  maxRectsRect node;
+} maxRectsChoice;
+
+typedef struct maxRectsEdge {
+  int start;
+  int end;
+} maxRectsEdge;
+
+typedef struct maxRectsEdgeList {
+  maxRectsEdge *data;
+  int count;
+  int capacity;
+} maxRectsEdgeList;
+
+// Edges of the used rects by coordinate for the contact point rule: left[x]
+// lists the y intervals of the used rects whose left edge is at x, and the
+// same for right, top and bottom. Used rects never overlap, so neither do
+// the intervals of one list, which are kept sorted. Only kept up to date
+// while the bin uses the contact point rule; used rects without area are
+// just counted and make scoring fall back to the plain scan.
+typedef struct maxRectsEdges {
+  maxRectsEdgeList *lists;
+  int listCapacity;
+  maxRectsEdgeList *left;
+  maxRectsEdgeList *right;
+  maxRectsEdgeList *top;
+  maxRectsEdgeList *bottom;
+  int emptyRects;
+  int active;
+} maxRectsEdges;
+
+struct maxRectsArena {
+  maxRectsRectArray freeRects;
+  maxRectsFreeLanes freeLanes;
+  maxRectsGrid grid;
+  maxRectsEdges edges;
+  maxRectsRectArray usedRects;
+  maxRectsRectArray inputRects;
+  maxRectsRectArray splitRects;
+  maxRectsChoice choices[MAX_RECTS_SLICES];
+  maxRectsProgress progress;
+  void *progressUser;
+  maxRectsParallelFor parallelFor;
+  void *parallelUser;
+  int online;
+  int staleFreeRects; // rects were removed since the free list was derived
+};
+
+struct maxRectsBin {
+  int width;
+  int height;
+  enum maxRectsFreeRectChoiceHeuristic method;
+  int allowRotations;
+  struct maxRectsArena arena;
+};
+
 typedef struct maxRectsContext {
   int width;
   int height;
@@ -46,661 +223,1439 @@ typedef struct maxRectsContext {
   maxRectsSize *rects;
   maxRectsPosition *layoutResults;
   enum maxRectsFreeRectChoiceHeuristic method;
-  int allowRotations:1;
-  maxRectsRect *freeRectLink;
-  maxRectsRect *usedRectLink;
-  maxRectsRect *inputRectLink;
+  int allowRotations;
+  maxRectsRectArray *freeRects;
+  maxRectsFreeLanes *freeLanes;
+  maxRectsGrid *grid;
+  maxRectsEdges *edges;
+  maxRectsRectArray *usedRects;
+  maxRectsRectArray *inputRects;
+  maxRectsRectArray *splitRects;
+  maxRectsChoice *choices;
+  int sliceCount;
+  void (*scoreInputs)(struct maxRectsContext *ctx, int begin, int end,
+    maxRectsChoice *choice);
+  maxRectsProgress progress;
+  void *progressUser;
+  maxRectsParallelFor parallelFor;
+  void *parallelUser;
+  int online;
 } maxRectsContext;
 
-static void addRectToLink(maxRectsRect *rect, maxRectsRect **link) {
-  rect->prev = 0;
-  rect->next = *link;
-  if (*link) {
-    (*link)->prev = rect;
+static int reserveRects(maxRectsRectArray *array, int capacity) {
+  maxRectsRect *data;
+  if (capacity <= array->capacity) {
+    return 0;
+  }
+  if (capacity < array->capacity * 2) {
+    capacity = array->capacity * 2;
+  }
+  data = (maxRectsRect *)realloc(array->data, sizeof(maxRectsRect) * capacity);
+  if (!data) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
   }
-  *link = rect;
+  array->data = data;
+  array->capacity = capacity;
+  return 0;
 }
 
-static void freeRectOnLine(maxRectsRect *rect, long line) {
-  //printf("%s:%ld: 0x%08x\n", __FUNCTION__, line,
-  //  (int)((char *)rect - (char *)0));
-  free(rect);
+static maxRectsRect *pushRect(maxRectsRectArray *array, int x, int y,
+    int width, int height, int rectOrder) {
+  maxRectsRect *rect;
+  assert(array->count < array->capacity);
+  rect = &array->data[array->count++];
+  rect->x = x;
+  rect->y = y;
+  rect->width = width;
+  rect->height = height;
+  rect->rectOrder = rectOrder;
+  rect->id = 0;
+  return rect;
 }
 
-#define freeRect(rect) \
-  freeRectOnLine((rect), __LINE__)
+static void compactRects(maxRectsRectArray *array) {
+  int i;
+  int count = 0;
+  for (i = 0; i < array->count; ++i) {
+    if (array->data[i].rectOrder != REMOVED_RECT_ORDER) {
+      array->data[count++] = array->data[i];
+    }
+  }
+  array->count = count;
+}
 
-static void removeRectFromLink(maxRectsRect *rect, maxRectsRect **link) {
-  if (rect->prev) {
-    rect->prev->next = rect->next;
+static int syncFreeLanes(maxRectsContext *ctx) {
+  maxRectsFreeLanes *lanes = ctx->freeLanes;
+  const maxRectsRect *rects = ctx->freeRects->data;
+  int count = ctx->freeRects->count - ctx->grid->deadRects;
+  int padded = (count + MAX_RECTS_LANES - 1) / MAX_RECTS_LANES *
+    MAX_RECTS_LANES;
+  int i;
+  int j;
+
+  if (padded > lanes->capacity) {
+    int capacity = MAX(padded, lanes->capacity * 2);
+    char *aligned;
+    void *memory = malloc(sizeof(int) * 4 * (size_t)capacity + 32);
+    if (!memory) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "malloc failed");
+      return -1;
+    }
+    free(lanes->memory);
+    aligned = (char *)memory + (32 - (size_t)memory % 32) % 32;
+    lanes->memory = memory;
+    lanes->x = (int *)aligned;
+    lanes->y = lanes->x + capacity;
+    lanes->width = lanes->y + capacity;
+    lanes->height = lanes->width + capacity;
+    lanes->capacity = capacity;
   }
-  if (rect->next) {
-    rect->next->prev = rect->prev;
+
+  for (i = 0, j = 0; j < ctx->freeRects->count; ++j) {
+    if (rects[j].rectOrder == REMOVED_RECT_ORDER) {
+      continue;
+    }
+    lanes->x[i] = rects[j].x;
+    lanes->y[i] = rects[j].y;
+    lanes->width[i] = rects[j].width;
+    lanes->height[i] = rects[j].height;
+    ++i;
   }
-  if (rect == *link) {
-    *link = rect->next;
+  for (; i < padded; ++i) {
+    lanes->x[i] = 0;
+    lanes->y[i] = 0;
+    lanes->width[i] = -1;
+    lanes->height[i] = -1;
   }
-  freeRect(rect);
+  lanes->count = count;
+  lanes->paddedCount = padded;
+  return 0;
 }
 
-static void freeLink(maxRectsRect **link) {
-  while (*link) {
-    maxRectsRect *willDel = *link;
-    *link = willDel->next;
-    freeRect(willDel);
+static void removeRectAt(maxRectsRectArray *array, int index) {
+  memmove(&array->data[index], &array->data[index + 1],
+    sizeof(maxRectsRect) * (array->count - index - 1));
+  --array->count;
+}
+
+maxRectsArena *maxRectsArenaCreate(void) {
+  maxRectsArena *arena = (maxRectsArena *)calloc(1, sizeof(maxRectsArena));
+  if (!arena) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
   }
+  return arena;
 }
 
-static void addRectToFreeRectLinkOnLine(maxRectsContext *ctx,
-    maxRectsRect *rect, long line) {
-  //printf("%s:%ld: 0x%08x\n", __FUNCTION__, line,
-  //  (int)((char *)rect - (char *)0));
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
-  rect->inFreeRectLink = 1;
-  addRectToLink(rect, &ctx->freeRectLink);
+static void releaseArena(maxRectsArena *arena) {
+  int i;
+  free(arena->freeRects.data);
+  free(arena->freeLanes.memory);
+  free(arena->grid.cells);
+  free(arena->grid.blocks);
+  free(arena->grid.found);
+  for (i = 0; i < arena->edges.listCapacity; ++i) {
+    free(arena->edges.lists[i].data);
+  }
+  free(arena->edges.lists);
+  free(arena->usedRects.data);
+  free(arena->inputRects.data);
+  free(arena->splitRects.data);
 }
 
-#define addRectToFreeRectLink(ctx, rect) \
-  addRectToFreeRectLinkOnLine((ctx), (rect), __LINE__)
+void maxRectsArenaDestroy(maxRectsArena *arena) {
+  if (!arena) {
+    return;
+  }
+  releaseArena(arena);
+  free(arena);
+}
 
-static void addRectToUsedRectLink(maxRectsContext *ctx, maxRectsRect *rect) {
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
-  rect->inUsedRectLink = 1;
-  addRectToLink(rect, &ctx->usedRectLink);
+void maxRectsArenaSetProgress(maxRectsArena *arena, maxRectsProgress progress,
+    void *user) {
+  arena->progress = progress;
+  arena->progressUser = user;
 }
 
-static void addRectToInputRectLink(maxRectsContext *ctx, maxRectsRect *rect) {
-  assert(!rect->inInputRectLink && !rect->inFreeRectLink &&
-    !rect->inUsedRectLink);
-  rect->inInputRectLink = 1;
-  addRectToLink(rect, &ctx->inputRectLink);
+void maxRectsArenaSetParallel(maxRectsArena *arena,
+    maxRectsParallelFor parallelFor, void *user) {
+  arena->parallelFor = parallelFor;
+  arena->parallelUser = user;
 }
 
-static void removeAndFreeRectFromUsedRectLink(maxRectsContext *ctx,
-    maxRectsRect *rect) {
-  //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
-  assert(rect->inUsedRectLink);
-  rect->inUsedRectLink = 0;
-  removeRectFromLink(rect, &ctx->usedRectLink);
+void maxRectsArenaSetOnline(maxRectsArena *arena, int online) {
+  arena->online = online;
 }
 
-static void removeAndFreeRectFromFreeRectLink(maxRectsContext *ctx,
-    maxRectsRect *rect) {
-  //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
-  assert(rect->inFreeRectLink);
-  rect->inFreeRectLink = 0;
-  removeRectFromLink(rect, &ctx->freeRectLink);
+#ifdef MAX_RECTS_LANES_SIMD
+
+/// Scores MAX_RECTS_LANES free rects at a time. Every lane keeps its own
+/// best candidate, taking later (higher) indices on ties, and the lanes are
+/// reduced at the end; the outcome is the one of the scalar loop, which
+/// walks the free rects from the back and keeps the first strictly better
+/// candidate, upright before rotated.
+MAX_RECTS_INLINE int findFreeLane(maxRectsContext *ctx, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    int *bestScore1, int *bestScore2, int *bestRotated) {
+  const maxRectsFreeLanes *lanes = ctx->freeLanes;
+  const laneVec worst = vset1(INT_MAX);
+  const laneVec w = vset1(width);
+  const laneVec h = vset1(height);
+  const laneVec wFit = vset1(width - 1);
+  const laneVec hFit = vset1(height - 1);
+  const laneVec area = vset1(width * height);
+  const laneVec rotations = vset1(allowRotations ? -1 : 0);
+  laneVec index = vlaneIndex();
+  const laneVec step = vset1(MAX_RECTS_LANES);
+  laneVec best1 = worst;
+  laneVec best2 = worst;
+  laneVec bestIndex = vset1(-1);
+  laneVec bestRot = vset1(0);
+  MAX_RECTS_ALIGNED int out1[MAX_RECTS_LANES];
+  MAX_RECTS_ALIGNED int out2[MAX_RECTS_LANES];
+  MAX_RECTS_ALIGNED int outIndex[MAX_RECTS_LANES];
+  MAX_RECTS_ALIGNED int outRot[MAX_RECTS_LANES];
+  int best = -1;
+  int i;
+
+  for (i = 0; i < lanes->paddedCount; i += MAX_RECTS_LANES) {
+    laneVec fx = vload(lanes->x + i);
+    laneVec fy = vload(lanes->y + i);
+    laneVec fw = vload(lanes->width + i);
+    laneVec fh = vload(lanes->height + i);
+    laneVec upFit = vand(vgt(fw, wFit), vgt(fh, hFit));
+    laneVec rotFit = vand(rotations, vand(vgt(fw, hFit), vgt(fh, wFit)));
+    laneVec upHoriz = vsub(fw, w);
+    laneVec upVert = vsub(fh, h);
+    laneVec rotHoriz = vsub(fw, h);
+    laneVec rotVert = vsub(fh, w);
+    laneVec up1;
+    laneVec up2;
+    laneVec rot1;
+    laneVec rot2;
+    laneVec rotBetter;
+    laneVec take;
+
+    switch (method) {
+      case rectBottomLeftRule:
+        up1 = vadd(fy, h);
+        rot1 = vadd(fy, w);
+        up2 = fx;
+        rot2 = fx;
+        break;
+      case rectBestLongSideFit:
+        up1 = vmax(upHoriz, upVert);
+        up2 = vmin(upHoriz, upVert);
+        rot1 = vmax(rotHoriz, rotVert);
+        rot2 = vmin(rotHoriz, rotVert);
+        break;
+      case rectBestAreaFit:
+        up1 = vsub(vmul(fw, fh), area);
+        rot1 = up1;
+        up2 = vmin(upHoriz, upVert);
+        rot2 = vmin(rotHoriz, rotVert);
+        break;
+      case rectBestShortSideFit:
+      default:
+        up1 = vmin(upHoriz, upVert);
+        up2 = vmax(upHoriz, upVert);
+        rot1 = vmin(rotHoriz, rotVert);
+        rot2 = vmax(rotHoriz, rotVert);
+        break;
+    }
+    up1 = vblend(worst, up1, upFit);
+    up2 = vblend(worst, up2, upFit);
+    rot1 = vblend(worst, rot1, rotFit);
+    rot2 = vblend(worst, rot2, rotFit);
+
+    // Rotated only wins a lane when strictly better than upright.
+    rotBetter = vor(vgt(up1, rot1), vand(veq(up1, rot1), vgt(up2, rot2)));
+    up1 = vblend(up1, rot1, rotBetter);
+    up2 = vblend(up2, rot2, rotBetter);
+
+    take = vor(vgt(best1, up1),
+      vand(veq(best1, up1), vandnot(vgt(up2, best2), vset1(-1))));
+    best1 = vblend(best1, up1, take);
+    best2 = vblend(best2, up2, take);
+    bestIndex = vblend(bestIndex, index, take);
+    bestRot = vblend(bestRot, rotBetter, take);
+    index = vadd(index, step);
+  }
+
+  vstore(out1, best1);
+  vstore(out2, best2);
+  vstore(outIndex, bestIndex);
+  vstore(outRot, bestRot);
+  for (i = 0; i < MAX_RECTS_LANES; ++i) {
+    if (INT_MAX == out1[i]) {
+      continue;
+    }
+    if (best < 0 || out1[i] < *bestScore1 ||
+        (out1[i] == *bestScore1 && (out2[i] < *bestScore2 ||
+          (out2[i] == *bestScore2 && outIndex[i] > best)))) {
+      best = outIndex[i];
+      *bestScore1 = out1[i];
+      *bestScore2 = out2[i];
+      *bestRotated = 0 != outRot[i];
+    }
+  }
+  return best;
 }
 
-static void removeAndFreeRectFromInputRectLink(maxRectsContext *ctx,
-    maxRectsRect *rect) {
-  //printf("%s: 0x%08x\n", __FUNCTION__, (int)((char *)rect - (char *)0));
-  assert(rect->inInputRectLink);
-  rect->inInputRectLink = 0;
-  removeRectFromLink(rect, &ctx->inputRectLink);
+#else
+
+/// Scores placing a width x height rect into the free rect fx, fy, fw, fh
+/// with every heuristic but the contact point rule. Lower is better, score1
+/// first. The scores of one heuristic are the ones its original
+/// findPositionForNewNode* function kept.
+MAX_RECTS_INLINE void scoreFreeRect(enum maxRectsFreeRectChoiceHeuristic method,
+    int fx, int fy, int fw, int fh, int width, int height,
+    int *score1, int *score2) {
+  int leftoverHoriz = fw - width;
+  int leftoverVert = fh - height;
+  switch (method) {
+    case rectBottomLeftRule:
+      *score1 = fy + height;
+      *score2 = fx;
+      break;
+    case rectBestLongSideFit:
+      *score1 = MAX(leftoverHoriz, leftoverVert);
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+    case rectBestAreaFit:
+      *score1 = fw * fh - width * height;
+      *score2 = MIN(leftoverHoriz, leftoverVert);
+      break;
+    case rectBestShortSideFit:
+    default:
+      *score1 = MIN(leftoverHoriz, leftoverVert);
+      *score2 = MAX(leftoverHoriz, leftoverVert);
+      break;
+  }
 }
 
-static maxRectsRect *createRectOnLine(int x, int y, int width, int height,
-    int rectOrder, long line) {
-  maxRectsRect *rect = (maxRectsRect *)calloc(1, sizeof(maxRectsRect));
-  if (!rect) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
-    return 0;
+MAX_RECTS_INLINE int findFreeLane(maxRectsContext *ctx, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    int *bestScore1, int *bestScore2, int *bestRotated) {
+  const maxRectsFreeLanes *lanes = ctx->freeLanes;
+  int best = -1;
+  int i;
+
+  for (i = lanes->count - 1; i >= 0; --i) {
+    int fx = lanes->x[i];
+    int fy = lanes->y[i];
+    int fw = lanes->width[i];
+    int fh = lanes->height[i];
+    int score1;
+    int score2;
+
+    // Try to place the rectangle in upright (non-flipped) orientation.
+    if (fw >= width && fh >= height) {
+      scoreFreeRect(method, fx, fy, fw, fh, width, height, &score1, &score2);
+      if (score1 < *bestScore1 ||
+          (score1 == *bestScore1 && score2 < *bestScore2)) {
+        best = i;
+        *bestScore1 = score1;
+        *bestScore2 = score2;
+        *bestRotated = 0;
+      }
+    }
+    if (allowRotations && fw >= height && fh >= width) {
+      scoreFreeRect(method, fx, fy, fw, fh, height, width, &score1, &score2);
+      if (score1 < *bestScore1 ||
+          (score1 == *bestScore1 && score2 < *bestScore2)) {
+        best = i;
+        *bestScore1 = score1;
+        *bestScore2 = score2;
+        *bestRotated = 1;
+      }
+    }
   }
-  rect->x = x;
-  rect->y = y;
-  rect->width = width;
-  rect->height = height;
-  rect->rectOrder = rectOrder;
-  //printf("%s:%ld: 0x%08x\n", __FUNCTION__, line,
-  //  (int)((char *)rect - (char *)0));
-  return rect;
+  return best;
 }
 
-#define createRect(x, y, width, height, rectOrder) \
-  createRectOnLine((x), (y), (width), (height), (rectOrder), __LINE__)
+#endif
 
-maxRectsRect *findPositionForNewNodeBottomLeft(maxRectsContext *ctx,
-    int width, int height, int *bestY, int *bestX) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
+MAX_RECTS_INLINE maxRectsRect findPositionForNewNodeLanes(
+    maxRectsContext *ctx, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    int *bestScore1, int *bestScore2) {
+  maxRectsRect bestNode = {0};
+  int rotated = 0;
+  int best;
+
+  *bestScore1 = INT_MAX;
+  *bestScore2 = INT_MAX;
+  best = findFreeLane(ctx, width, height, method, allowRotations, bestScore1,
+    bestScore2, &rotated);
+  if (best >= 0) {
+    bestNode.x = ctx->freeLanes->x[best];
+    bestNode.y = ctx->freeLanes->y[best];
+    bestNode.width = rotated ? height : width;
+    bestNode.height = rotated ? width : height;
   }
+  return bestNode;
+}
 
-	*bestY = INT_MAX;
-
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int topSideY = (int)loop->y + height;
-			if (topSideY < *bestY || (topSideY == *bestY && loop->x < *bestX)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestY = topSideY;
-				*bestX = (int)loop->x;
-			}
-		}
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int topSideY = (int)loop->y + width;
-			if (topSideY < *bestY || (topSideY == *bestY && loop->x < *bestX)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestY = topSideY;
-				*bestX = (int)loop->x;
-			}
-		}
-	}
-	return bestNode;
-}
-
-maxRectsRect *findPositionForNewNodeBestShortSideFit(maxRectsContext *ctx,
-    int width, int height, int *bestShortSideFit, int *bestLongSideFit)  {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
+/// Returns 0 if the two intervals i1 and i2 are disjoint, or the length of their overlap otherwise.
+static int commonIntervalLength(int i1start, int i1end,
+    int i2start, int i2end) {
+  if (i1end < i2start || i2end < i1start)
     return 0;
+  return MIN(i1end, i2end) - MAX(i1start, i2start);
+}
+
+/// Index of the first edge in list ending after start. The edges of a list
+/// are disjoint, so sorting them by start sorts them by end as well.
+static int findEdge(const maxRectsEdgeList *list, int start) {
+  int low = 0;
+  int high = list->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (list->data[middle].end <= start) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
   }
+  return low;
+}
 
-	*bestShortSideFit = INT_MAX;
-
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (shortSideFit < *bestShortSideFit ||
-          (shortSideFit == *bestShortSideFit &&
-            longSideFit < *bestLongSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
-
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int flippedLeftoverHoriz = abs((int)loop->width - height);
-			int flippedLeftoverVert = abs((int)loop->height - width);
-			int flippedShortSideFit = MIN(flippedLeftoverHoriz, flippedLeftoverVert);
-			int flippedLongSideFit = MAX(flippedLeftoverHoriz, flippedLeftoverVert);
-
-			if (flippedShortSideFit < *bestShortSideFit ||
-          (flippedShortSideFit == *bestShortSideFit &&
-            flippedLongSideFit < *bestLongSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = flippedShortSideFit;
-				*bestLongSideFit = flippedLongSideFit;
-			}
-		}
-	}
-	return bestNode;
-}
-
-maxRectsRect *findPositionForNewNodeBestLongSideFit(maxRectsContext *ctx,
-    int width, int height, int *bestShortSideFit, int *bestLongSideFit) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
+static int insertEdge(maxRectsEdgeList *list, int start, int end) {
+  int i = findEdge(list, start);
+  if (list->count == list->capacity) {
+    int capacity = MAX(4, list->capacity * 2);
+    maxRectsEdge *data = (maxRectsEdge *)realloc(list->data,
+      sizeof(maxRectsEdge) * capacity);
+    if (!data) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    list->data = data;
+    list->capacity = capacity;
   }
+  memmove(&list->data[i + 1], &list->data[i],
+    sizeof(maxRectsEdge) * (list->count - i));
+  list->data[i].start = start;
+  list->data[i].end = end;
+  ++list->count;
+  return 0;
+}
+
+static void eraseEdge(maxRectsEdgeList *list, int start) {
+  int i = findEdge(list, start);
+  assert(i < list->count && list->data[i].start == start);
+  memmove(&list->data[i], &list->data[i + 1],
+    sizeof(maxRectsEdge) * (list->count - i - 1));
+  --list->count;
+}
+
+/// Total length the edges in list share with the interval start, end.
+static int edgeContact(const maxRectsEdgeList *list, int start, int end) {
+  const maxRectsEdge *loop = list->data + findEdge(list, start);
+  const maxRectsEdge *last = list->data + list->count;
+  int length = 0;
+  for (; loop != last && loop->start < end; ++loop) {
+    length += MIN(loop->end, end) - MAX(loop->start, start);
+  }
+  return length;
+}
 
-	*bestLongSideFit = INT_MAX;
-
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (longSideFit < *bestLongSideFit ||
-          (longSideFit == *bestLongSideFit &&
-            shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
-
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int leftoverHoriz = abs((int)loop->width - height);
-			int leftoverVert = abs((int)loop->height - width);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-			int longSideFit = MAX(leftoverHoriz, leftoverVert);
-
-			if (longSideFit < *bestLongSideFit ||
-          (longSideFit == *bestLongSideFit &&
-            shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = shortSideFit;
-				*bestLongSideFit = longSideFit;
-			}
-		}
-	}
-	return bestNode;
-}
-
-maxRectsRect *findPositionForNewNodeBestAreaFit(maxRectsContext *ctx,
-    int width, int height, int *bestAreaFit, int *bestShortSideFit) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
+static int resetEdges(maxRectsContext *ctx) {
+  maxRectsEdges *edges = ctx->edges;
+  int count = 2 * (ctx->width + 1) + 2 * (ctx->height + 1);
+  int i;
+  edges->emptyRects = 0;
+  edges->active = 0;
+  if (ctx->method != rectContactPointRule) {
     return 0;
   }
+  if (count > edges->listCapacity) {
+    maxRectsEdgeList *lists = (maxRectsEdgeList *)realloc(edges->lists,
+      sizeof(maxRectsEdgeList) * count);
+    if (!lists) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    memset(lists + edges->listCapacity, 0,
+      sizeof(maxRectsEdgeList) * (count - edges->listCapacity));
+    edges->lists = lists;
+    edges->listCapacity = count;
+  }
+  for (i = 0; i < count; ++i) {
+    edges->lists[i].count = 0;
+  }
+  edges->left = edges->lists;
+  edges->right = edges->left + ctx->width + 1;
+  edges->top = edges->right + ctx->width + 1;
+  edges->bottom = edges->top + ctx->height + 1;
+  edges->active = 1;
+  return 0;
+}
 
-	*bestAreaFit = INT_MAX;
-
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		int areaFit = (int)loop->width * (int)loop->height - width * height;
-
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int leftoverHoriz = abs((int)loop->width - width);
-			int leftoverVert = abs((int)loop->height - height);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-
-			if (areaFit < *bestAreaFit ||
-          (areaFit == *bestAreaFit && shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestShortSideFit = shortSideFit;
-				*bestAreaFit = areaFit;
-			}
-		}
-
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int leftoverHoriz = abs((int)loop->width - height);
-			int leftoverVert = abs((int)loop->height - width);
-			int shortSideFit = MIN(leftoverHoriz, leftoverVert);
-
-			if (areaFit < *bestAreaFit ||
-          (areaFit == *bestAreaFit && shortSideFit < *bestShortSideFit)) {
-				bestNode->x = loop->x;
-				bestNode->y = loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestShortSideFit = shortSideFit;
-				*bestAreaFit = areaFit;
-			}
-		}
-	}
-	return bestNode;
+static int addEdges(maxRectsContext *ctx, const maxRectsRect *rect) {
+  maxRectsEdges *edges = ctx->edges;
+  if (!edges->active) {
+    return 0;
+  }
+  if (0 == rect->width || 0 == rect->height) {
+    ++edges->emptyRects;
+    return 0;
+  }
+  if (0 != insertEdge(&edges->left[rect->x], rect->y,
+        rect->y + rect->height) ||
+      0 != insertEdge(&edges->right[rect->x + rect->width], rect->y,
+        rect->y + rect->height) ||
+      0 != insertEdge(&edges->top[rect->y], rect->x,
+        rect->x + rect->width) ||
+      0 != insertEdge(&edges->bottom[rect->y + rect->height], rect->x,
+        rect->x + rect->width)) {
+    edges->active = 0;
+    return -1;
+  }
+  return 0;
 }
 
-/// Returns 0 if the two intervals i1 and i2 are disjoint, or the length of their overlap otherwise.
-static int commonIntervalLength(int i1start, int i1end,
-    int i2start, int i2end) {
-	if (i1end < i2start || i2end < i1start)
-		return 0;
-	return MIN(i1end, i2end) - MAX(i1start, i2start);
+static void removeEdges(maxRectsContext *ctx, const maxRectsRect *rect) {
+  maxRectsEdges *edges = ctx->edges;
+  if (!edges->active) {
+    return;
+  }
+  if (0 == rect->width || 0 == rect->height) {
+    --edges->emptyRects;
+    return;
+  }
+  eraseEdge(&edges->left[rect->x], rect->y);
+  eraseEdge(&edges->right[rect->x + rect->width], rect->y);
+  eraseEdge(&edges->top[rect->y], rect->x);
+  eraseEdge(&edges->bottom[rect->y + rect->height], rect->x);
 }
 
 static int contactPointScoreNode(maxRectsContext *ctx, int x, int y,
     int width, int height) {
-  maxRectsRect *loop;
-	int score = 0;
-
-	if (x == 0 || x + width == ctx->width)
-		score += height;
-	if (y == 0 || y + height == ctx->height)
-		score += width;
-
-	for(loop = ctx->usedRectLink; loop; loop = loop->next) {
-		if (loop->x == x + width || loop->x + loop->width == x)
-			score += commonIntervalLength((int)loop->y,
-        (int)loop->y + (int)loop->height,
+  const maxRectsEdges *edges = ctx->edges;
+  const maxRectsRect *loop = ctx->usedRects->data;
+  const maxRectsRect *end = loop + ctx->usedRects->count;
+  int score = 0;
+
+  if (x == 0 || x + width == ctx->width)
+    score += height;
+  if (y == 0 || y + height == ctx->height)
+    score += width;
+
+  // Only the used rects with an edge on one of the four sides can touch
+  // the node. Nodes and used rects without area keep the plain scan.
+  if (edges->active && 0 == edges->emptyRects && width > 0 && height > 0) {
+    return score +
+      edgeContact(&edges->left[x + width], y, y + height) +
+      edgeContact(&edges->right[x], y, y + height) +
+      edgeContact(&edges->top[y + height], x, x + width) +
+      edgeContact(&edges->bottom[y], x, x + width);
+  }
+
+  for (; loop != end; ++loop) {
+    if (loop->x == x + width || loop->x + loop->width == x)
+      score += commonIntervalLength(loop->y, loop->y + loop->height,
         y, y + height);
-		if (loop->y == y + height || loop->y + loop->height == y)
-			score += commonIntervalLength((int)loop->x,
-        (int)loop->x + (int)loop->width, x, x + width);
-	}
-	return score;
-}
-
-maxRectsRect *findPositionForNewNodeContactPoint(maxRectsContext *ctx,
-    int width, int height, int *bestContactScore) {
-  maxRectsRect *loop;
-	maxRectsRect *bestNode = createRect(0, 0, 0, 0, 0);
-  if (!bestNode) {
-    return 0;
+    if (loop->y == y + height || loop->y + loop->height == y)
+      score += commonIntervalLength(loop->x, loop->x + loop->width,
+        x, x + width);
   }
+  return score;
+}
 
-	*bestContactScore = -1;
-
-	for(loop = ctx->freeRectLink; loop; loop = loop->next) {
-		// Try to place the rectangle in upright (non-flipped) orientation.
-		if (loop->width >= width && loop->height >= height) {
-			int score = contactPointScoreNode(ctx, (int)loop->x, (int)loop->y,
-        width, height);
-			if (score > *bestContactScore) {
-				bestNode->x = (int)loop->x;
-				bestNode->y = (int)loop->y;
-				bestNode->width = width;
-				bestNode->height = height;
-				*bestContactScore = score;
-			}
-		}
-		if (ctx->allowRotations && loop->width >= height && loop->height >= width) {
-			int score = contactPointScoreNode(ctx, (int)loop->x, (int)loop->y,
-        height, width);
-			if (score > *bestContactScore) {
-				bestNode->x = (int)loop->x;
-				bestNode->y = (int)loop->y;
-				bestNode->width = height;
-				bestNode->height = width;
-				*bestContactScore = score;
-			}
-		}
-	}
-	return bestNode;
-}
-
-static int initContext(maxRectsContext *ctx) {
+MAX_RECTS_INLINE maxRectsRect findPositionForNewNodeContactPoint(
+    maxRectsContext *ctx, int width, int height, int allowRotations,
+    int *bestContactScore) {
+  const maxRectsRect *loop = ctx->freeRects->data + ctx->freeRects->count;
+  maxRectsRect bestNode = {0};
+
+  *bestContactScore = -1;
+
+  while (loop-- != ctx->freeRects->data) {
+    if (loop->rectOrder == REMOVED_RECT_ORDER) {
+      continue;
+    }
+    // Try to place the rectangle in upright (non-flipped) orientation.
+    if (loop->width >= width && loop->height >= height) {
+      int score = contactPointScoreNode(ctx, loop->x, loop->y, width, height);
+      if (score > *bestContactScore) {
+        bestNode.x = loop->x;
+        bestNode.y = loop->y;
+        bestNode.width = width;
+        bestNode.height = height;
+        *bestContactScore = score;
+      }
+    }
+    if (allowRotations && loop->width >= height && loop->height >= width) {
+      int score = contactPointScoreNode(ctx, loop->x, loop->y, height, width);
+      if (score > *bestContactScore) {
+        bestNode.x = loop->x;
+        bestNode.y = loop->y;
+        bestNode.width = height;
+        bestNode.height = width;
+        *bestContactScore = score;
+      }
+    }
+  }
+  return bestNode;
+}
+
+static void bindContext(maxRectsContext *ctx, maxRectsArena *arena,
+    int width, int height, enum maxRectsFreeRectChoiceHeuristic method,
+    int allowRotations) {
+  memset(ctx, 0, sizeof(maxRectsContext));
+  ctx->width = width;
+  ctx->height = height;
+  ctx->method = method;
+  ctx->allowRotations = allowRotations;
+  ctx->freeRects = &arena->freeRects;
+  ctx->freeLanes = &arena->freeLanes;
+  ctx->grid = &arena->grid;
+  ctx->edges = &arena->edges;
+  ctx->usedRects = &arena->usedRects;
+  ctx->inputRects = &arena->inputRects;
+  ctx->splitRects = &arena->splitRects;
+  ctx->choices = arena->choices;
+  ctx->progress = arena->progress;
+  ctx->progressUser = arena->progressUser;
+  ctx->parallelFor = arena->parallelFor;
+  ctx->parallelUser = arena->parallelUser;
+  ctx->online = arena->online;
+}
+
+static int clearContext(maxRectsContext *ctx) {
+  ctx->freeRects->count = 0;
+  ctx->grid->deadRects = 0;
+  ctx->grid->valid = 0;
+  ctx->usedRects->count = 0;
+  if (0 != resetEdges(ctx)) {
+    return -1;
+  }
+  if (0 != reserveRects(ctx->freeRects, 16)) {
+    return -1;
+  }
+  pushRect(ctx->freeRects, 0, 0, ctx->width, ctx->height, 0);
+  return 0;
+}
+
+static int initInputs(maxRectsContext *ctx, const int *ids) {
   int i;
-  maxRectsRect *newRect = createRect(0, 0, ctx->width, ctx->height, 0);
-  if (!newRect) {
-    fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
+  ctx->inputRects->count = 0;
+  ctx->splitRects->count = 0;
+  // Every placement leaves a handful of free rects behind, so reserve a
+  // generous free list up front; the arena keeps whatever it grew to.
+  if (0 != reserveRects(ctx->freeRects,
+        ctx->freeRects->count + 4 * ctx->rectCount + 16) ||
+      0 != reserveRects(ctx->splitRects, 4 * ctx->rectCount + 16) ||
+      0 != reserveRects(ctx->usedRects,
+        ctx->usedRects->count + ctx->rectCount) ||
+      0 != reserveRects(ctx->inputRects, ctx->rectCount)) {
     return -1;
   }
-  addRectToFreeRectLink(ctx, newRect);
   for (i = 0; i < ctx->rectCount; ++i) {
-    newRect = createRect(0, 0, ctx->rects[i].width,
-        ctx->rects[i].height, i + 1);
-    if (!newRect) {
-      fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
-      return -1;
-    }
-    addRectToInputRectLink(ctx, newRect);
+    maxRectsRect *input = pushRect(ctx->inputRects, 0, 0,
+      ctx->rects[i].width, ctx->rects[i].height, i + 1);
+    input->id = ids ? ids[i] : i;
   }
   return 0;
 }
 
-static void releaseContext(maxRectsContext *ctx) {
-  freeLink(&ctx->usedRectLink);
-  freeLink(&ctx->freeRectLink);
-  freeLink(&ctx->inputRectLink);
+static float getOccupany(maxRectsContext *ctx) {
+  unsigned long long usedSurfaceArea = 0;
+  int i;
+  for (i = 0; i < ctx->usedRects->count; ++i) {
+    usedSurfaceArea += ctx->usedRects->data[i].width *
+      ctx->usedRects->data[i].height;
+  }
+  return (float)usedSurfaceArea / (ctx->width * ctx->height);
 }
 
-static float getOccupany(maxRectsContext *ctx) {
-	unsigned long long usedSurfaceArea = 0;
-  maxRectsRect *loop = ctx->usedRectLink;
-	while (loop) {
-    usedSurfaceArea += loop->width * loop->height;
-    loop = loop->next;
-  }
-	return (float)usedSurfaceArea / (ctx->width * ctx->height);
-}
-
-maxRectsRect *scoreRect(maxRectsContext *ctx, int width, int height,
-    enum maxRectsFreeRectChoiceHeuristic method, int *score1, int *score2) {
-	maxRectsRect *newNode = 0;
-	*score1 = INT_MAX;
-	*score2 = INT_MAX;
-	switch(method) {
-		case rectBestShortSideFit:
-      newNode = findPositionForNewNodeBestShortSideFit(ctx, width, height,
-        score1, score2);
-      break;
-		case rectBottomLeftRule:
-      newNode = findPositionForNewNodeBottomLeft(ctx, width, height,
-        score1, score2);
-      break;
-		case rectContactPointRule:
-      newNode = findPositionForNewNodeContactPoint(ctx, width, height, score1);
-			*score1 = -*score1; // Reverse since we are minimizing, but for contact point score bigger is better.
-			break;
-		case rectBestLongSideFit:
-      newNode = findPositionForNewNodeBestLongSideFit(ctx, width, height,
-        score2, score1);
+MAX_RECTS_INLINE maxRectsRect scoreRect(maxRectsContext *ctx, int width,
+    int height, enum maxRectsFreeRectChoiceHeuristic method,
+    int allowRotations, int *score1, int *score2) {
+  maxRectsRect newNode = {0};
+  *score1 = INT_MAX;
+  *score2 = INT_MAX;
+  switch(method) {
+    case rectContactPointRule:
+      newNode = findPositionForNewNodeContactPoint(ctx, width, height,
+        allowRotations, score1);
+      *score1 = -*score1; // Reverse since we are minimizing, but for contact point score bigger is better.
       break;
-		case rectBestAreaFit:
-      newNode = findPositionForNewNodeBestAreaFit(ctx, width, height,
-        score1, score2);
+    case rectBestShortSideFit:
+    case rectBottomLeftRule:
+    case rectBestLongSideFit:
+    case rectBestAreaFit:
+      newNode = findPositionForNewNodeLanes(ctx, width, height, method,
+        allowRotations, score1, score2);
       break;
-	}
+  }
 
-	// Cannot fit the current rectangle.
-	if (!newNode || 0 == newNode->height) {
-		*score1 = INT_MAX;
-		*score2 = INT_MAX;
-	}
+  // Cannot fit the current rectangle.
+  if (0 == newNode.height) {
+    *score1 = INT_MAX;
+    *score2 = INT_MAX;
+  }
 
-	return newNode;
+  return newNode;
 }
 
-int splitFreeNode(maxRectsContext *ctx, maxRectsRect *freeNode,
-    maxRectsRect *usedNode) {
-	// Test with SAT if the rectangles even intersect.
-	if (usedNode->x >= freeNode->x + freeNode->width ||
+static int splitFreeNode(maxRectsContext *ctx, const maxRectsRect *freeNode,
+    const maxRectsRect *usedNode) {
+  maxRectsRectArray *split = ctx->splitRects;
+
+  // Test with SAT if the rectangles even intersect.
+  if (usedNode->x >= freeNode->x + freeNode->width ||
       usedNode->x + usedNode->width <= freeNode->x ||
-		  usedNode->y >= freeNode->y + freeNode->height ||
+      usedNode->y >= freeNode->y + freeNode->height ||
       usedNode->y + usedNode->height <= freeNode->y)
-		return 0;
+    return 0;
 
-	if (usedNode->x < freeNode->x + freeNode->width &&
+  if (usedNode->x < freeNode->x + freeNode->width &&
       usedNode->x + usedNode->width > freeNode->x) {
-		// New node at the top side of the used node.
-		if (usedNode->y > freeNode->y && usedNode->y <
+    // New node at the top side of the used node.
+    if (usedNode->y > freeNode->y && usedNode->y <
         freeNode->y + freeNode->height) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-			if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
-        return -1;
-      }
-			newNode->height = usedNode->y - newNode->y;
-      addRectToFreeRectLink(ctx, newNode);
-		}
-
-		// New node at the bottom side of the used node.
-		if (usedNode->y + usedNode->height < freeNode->y + freeNode->height) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
-        return -1;
-      }
-			newNode->y = usedNode->y + usedNode->height;
-			newNode->height = freeNode->y + freeNode->height -
-        (usedNode->y + usedNode->height);
-      addRectToFreeRectLink(ctx, newNode);
-		}
-	}
-
-	if (usedNode->y < freeNode->y + freeNode->height &&
+      pushRect(split, freeNode->x, freeNode->y, freeNode->width,
+        usedNode->y - freeNode->y, 0);
+    }
+
+    // New node at the bottom side of the used node.
+    if (usedNode->y + usedNode->height < freeNode->y + freeNode->height) {
+      pushRect(split, freeNode->x, usedNode->y + usedNode->height,
+        freeNode->width, freeNode->y + freeNode->height -
+        (usedNode->y + usedNode->height), 0);
+    }
+  }
+
+  if (usedNode->y < freeNode->y + freeNode->height &&
       usedNode->y + usedNode->height > freeNode->y) {
-		// New node at the left side of the used node.
-		if (usedNode->x > freeNode->x && usedNode->x <
+    // New node at the left side of the used node.
+    if (usedNode->x > freeNode->x && usedNode->x <
         freeNode->x + freeNode->width) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
-        return -1;
-      }
-			newNode->width = usedNode->x - newNode->x;
-			addRectToFreeRectLink(ctx, newNode);
-		}
+      pushRect(split, freeNode->x, freeNode->y, usedNode->x - freeNode->x,
+        freeNode->height, 0);
+    }
 
-		// New node at the right side of the used node.
-		if (usedNode->x + usedNode->width <
+    // New node at the right side of the used node.
+    if (usedNode->x + usedNode->width <
         freeNode->x + freeNode->width) {
-      maxRectsRect *newNode = createRect(freeNode->x, freeNode->y,
-        freeNode->width, freeNode->height, 0);
-      if (!newNode) {
-        fprintf(stderr, "%s: %s\n", __FUNCTION__, "createRect failed");
-        return -1;
+      pushRect(split, usedNode->x + usedNode->width, freeNode->y,
+        freeNode->x + freeNode->width - (usedNode->x + usedNode->width),
+        freeNode->height, 0);
+    }
+  }
+
+  return 1;
+}
+
+static int isContainedIn(const maxRectsRect *a, const maxRectsRect *b) {
+  return a->x >= b->x && a->y >= b->y &&
+    a->x + a->width <= b->x + b->width &&
+    a->y + a->height <= b->y + b->height;
+}
+
+static int reserveInts(int **data, int *capacity, int count) {
+  int *grown;
+  if (count <= *capacity) {
+    return 0;
+  }
+  count = MAX(count, *capacity * 2);
+  grown = (int *)realloc(*data, sizeof(int) * count);
+  if (!grown) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  *data = grown;
+  *capacity = count;
+  return 0;
+}
+
+static void gridRange(const maxRectsGrid *grid, const maxRectsRect *rect,
+    int *left, int *top, int *right, int *bottom) {
+  *left = MIN(rect->x >> grid->shift, grid->columns - 1);
+  *top = MIN(rect->y >> grid->shift, grid->rows - 1);
+  *right = MIN((rect->x + rect->width - 1) >> grid->shift, grid->columns - 1);
+  *bottom = MIN((rect->y + rect->height - 1) >> grid->shift, grid->rows - 1);
+}
+
+static int allocGridBlock(maxRectsGrid *grid) {
+  int block = grid->freeBlock;
+  if (block >= 0) {
+    grid->freeBlock = grid->blocks[block].next;
+    return block;
+  }
+  if (grid->blockCount == grid->blockCapacity) {
+    int capacity = MAX(64, grid->blockCapacity * 2);
+    maxRectsGridBlock *blocks = (maxRectsGridBlock *)realloc(grid->blocks,
+      sizeof(maxRectsGridBlock) * capacity);
+    if (!blocks) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+      return -1;
+    }
+    grid->blocks = blocks;
+    grid->blockCapacity = capacity;
+  }
+  return grid->blockCount++;
+}
+
+static int addToGrid(maxRectsGrid *grid, const maxRectsRect *rect,
+    int index) {
+  int left, top, right, bottom;
+  int x, y;
+  gridRange(grid, rect, &left, &top, &right, &bottom);
+  for (y = top; y <= bottom; ++y) {
+    for (x = left; x <= right; ++x) {
+      int *first = &grid->cells[y * grid->columns + x];
+      maxRectsGridBlock *block;
+      if (*first < 0 ||
+          grid->blocks[*first].count == MAX_RECTS_GRID_BLOCK) {
+        int grown = allocGridBlock(grid);
+        if (grown < 0) {
+          return -1;
+        }
+        grid->blocks[grown].next = *first;
+        grid->blocks[grown].count = 0;
+        *first = grown;
       }
-			newNode->x = usedNode->x + usedNode->width;
-			newNode->width = freeNode->x + freeNode->width -
-        (usedNode->x + usedNode->width);
-			addRectToFreeRectLink(ctx, newNode);
-		}
-	}
-
-	return 1;
-}
-
-static int isContainedIn(maxRectsRect *a, maxRectsRect *b) {
-	return a->x >= b->x && a->y >= b->y &&
-		a->x + a->width <= b->x + b->width &&
-		a->y + a->height <= b->y + b->height;
-}
-
-static void pruneFreeList(maxRectsContext *ctx) {
-  maxRectsRect *outerLoop = ctx->freeRectLink;
-  while (outerLoop) {
-    maxRectsRect *innerLoop;
-    maxRectsRect *outer = outerLoop;
-    outerLoop = outerLoop->next;
-    innerLoop = outerLoop;
-    while (innerLoop) {
-      maxRectsRect *inner = innerLoop;
-      innerLoop = innerLoop->next;
-      if (isContainedIn(outer, inner)) {
-        removeAndFreeRectFromFreeRectLink(ctx, outer);
-				break;
-			}
-      if (isContainedIn(inner, outer)) {
-        if (inner == outerLoop) {
-          outerLoop = outerLoop->next;
+      block = &grid->blocks[*first];
+      block->indices[block->count++] = index;
+    }
+  }
+  return 0;
+}
+
+/// Moves the last index of the cell, in its first block, over the one
+/// removed.
+static void removeFromGrid(maxRectsGrid *grid, const maxRectsRect *rect,
+    int index) {
+  int left, top, right, bottom;
+  int x, y, b, i;
+  gridRange(grid, rect, &left, &top, &right, &bottom);
+  for (y = top; y <= bottom; ++y) {
+    for (x = left; x <= right; ++x) {
+      int *first = &grid->cells[y * grid->columns + x];
+      for (b = *first; b >= 0; b = grid->blocks[b].next) {
+        maxRectsGridBlock *block = &grid->blocks[b];
+        for (i = 0; i < block->count; ++i) {
+          if (block->indices[i] == index) {
+            break;
+          }
+        }
+        if (i < block->count) {
+          maxRectsGridBlock *head = &grid->blocks[*first];
+          block->indices[i] = head->indices[--head->count];
+          if (0 == head->count) {
+            int emptied = *first;
+            *first = head->next;
+            head->next = grid->freeBlock;
+            grid->freeBlock = emptied;
+          }
+          break;
         }
-        removeAndFreeRectFromFreeRectLink(ctx, inner);
       }
     }
   }
 }
 
-static int placeRect(maxRectsContext *ctx, maxRectsRect *rect) {
-  maxRectsRect *loop = ctx->freeRectLink;
-  while (loop) {
-    maxRectsRect *freeNode = loop;
-    int splitResult = splitFreeNode(ctx, freeNode, rect);
-    if (splitResult < 0) {
+/// Free rects without area, as a bin of zero width or height starts with,
+/// take no rect and cover no grid cell, so they are dropped before they
+/// would be indexed.
+static int isEmptyRect(const maxRectsRect *rect) {
+  return rect->width <= 0 || rect->height <= 0;
+}
+
+/// Compacts the free list and indexes it again, with cells of at least 8
+/// pixels and no more than 64 of them along either side.
+static int rebuildGrid(maxRectsContext *ctx) {
+  maxRectsGrid *grid = ctx->grid;
+  int cellCount;
+  int i;
+
+  for (i = 0; i < ctx->freeRects->count; ++i) {
+    if (isEmptyRect(&ctx->freeRects->data[i])) {
+      ctx->freeRects->data[i].rectOrder = REMOVED_RECT_ORDER;
+    }
+  }
+  compactRects(ctx->freeRects);
+  grid->shift = 3;
+  while ((ctx->width - 1) >> grid->shift >= 64 ||
+      (ctx->height - 1) >> grid->shift >= 64) {
+    ++grid->shift;
+  }
+  grid->columns = MAX(1, ((ctx->width - 1) >> grid->shift) + 1);
+  grid->rows = MAX(1, ((ctx->height - 1) >> grid->shift) + 1);
+  cellCount = grid->columns * grid->rows;
+  if (cellCount > grid->cellCapacity) {
+    int *cells = (int *)realloc(grid->cells, sizeof(int) * cellCount);
+    if (!cells) {
+      fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
       return -1;
     }
-    loop = loop->next;
-    if (splitResult) {
-      removeAndFreeRectFromFreeRectLink(ctx, freeNode);
+    grid->cells = cells;
+    grid->cellCapacity = cellCount;
+  }
+  for (i = 0; i < cellCount; ++i) {
+    grid->cells[i] = -1;
+  }
+  grid->blockCount = 0;
+  grid->freeBlock = -1;
+  for (i = 0; i < ctx->freeRects->count; ++i) {
+    if (0 != addToGrid(grid, &ctx->freeRects->data[i], i)) {
+      return -1;
     }
   }
-  pruneFreeList(ctx);
-  addRectToUsedRectLink(ctx, rect);
+  grid->deadRects = 0;
+  grid->valid = 1;
   return 0;
 }
 
-static int startLayout(maxRectsContext *ctx) {
-  while (ctx->inputRectLink) {
-    int bestScore1 = INT_MAX;
-		int bestScore2 = INT_MAX;
-    maxRectsRect *bestNode = 0;
-    maxRectsRect *bestRect = 0;
-    maxRectsRect *loop = ctx->inputRectLink;
-    while (loop) {
-      int score1 = 0;
-			int score2 = 0;
-      maxRectsRect *newRect = 0;
-      newRect = scoreRect(ctx, loop->width, loop->height, ctx->method,
-          &score1, &score2);
-      if (!newRect) {
-        return -1;
+static int compareDescending(const void *a, const void *b) {
+  return *(const int *)b - *(const int *)a;
+}
+
+/// Fills grid->found with the free rects sharing a cell with rect, highest
+/// index first.
+static int collectOverlaps(maxRectsGrid *grid, const maxRectsRect *rect) {
+  int left, top, right, bottom;
+  int x, y, b, i, count;
+  gridRange(grid, rect, &left, &top, &right, &bottom);
+  grid->foundCount = 0;
+  for (y = top; y <= bottom; ++y) {
+    for (x = left; x <= right; ++x) {
+      for (b = grid->cells[y * grid->columns + x]; b >= 0;
+          b = grid->blocks[b].next) {
+        const maxRectsGridBlock *block = &grid->blocks[b];
+        if (0 != reserveInts(&grid->found, &grid->foundCapacity,
+            grid->foundCount + block->count)) {
+          return -1;
+        }
+        memcpy(grid->found + grid->foundCount, block->indices,
+          sizeof(int) * block->count);
+        grid->foundCount += block->count;
       }
-      if (score1 < bestScore1 ||
-          (score1 == bestScore1 && score2 < bestScore2)) {
-				bestScore1 = score1;
-				bestScore2 = score2;
-        if (bestNode) {
-          freeRect(bestNode);
+    }
+  }
+  if (grid->foundCount > 1) {
+    qsort(grid->found, grid->foundCount, sizeof(int), compareDescending);
+  }
+  for (i = 0, count = 0; i < grid->foundCount; ++i) {
+    if (0 == count || grid->found[count - 1] != grid->found[i]) {
+      grid->found[count++] = grid->found[i];
+    }
+  }
+  grid->foundCount = count;
+  return 0;
+}
+
+/// Drops the free rects that lie in another free rect after a placement,
+/// touching only the free rects the split added from firstNew on. The older free rects do not
+/// contain each other and none of them can lie inside a new one, as every
+/// new rect lies inside the old rect it was split from; so only new rects
+/// get dropped, when they lie in a later new rect or an old one. Old rects
+/// containing a new rect cover its top left corner and so share its cell.
+static int pruneNewFreeRects(maxRectsContext *ctx, int firstNew) {
+  maxRectsRect *rects = ctx->freeRects->data;
+  maxRectsGrid *grid = ctx->grid;
+  int i;
+  int j;
+  int b;
+  for (i = ctx->freeRects->count - 1; i >= firstNew; --i) {
+    maxRectsRect *outer = &rects[i];
+    if (isEmptyRect(outer)) {
+      outer->rectOrder = REMOVED_RECT_ORDER;
+    }
+    if (outer->rectOrder == REMOVED_RECT_ORDER) {
+      continue;
+    }
+    for (j = i - 1; j >= firstNew; --j) {
+      maxRectsRect *inner = &rects[j];
+      if (inner->rectOrder == REMOVED_RECT_ORDER) {
+        continue;
+      }
+      if (isContainedIn(outer, inner)) {
+        outer->rectOrder = REMOVED_RECT_ORDER;
+        break;
+      }
+      if (isContainedIn(inner, outer)) {
+        inner->rectOrder = REMOVED_RECT_ORDER;
+      }
+    }
+    if (outer->rectOrder == REMOVED_RECT_ORDER) {
+      continue;
+    }
+    b = grid->cells[MIN(outer->y >> grid->shift, grid->rows - 1) *
+      grid->columns + MIN(outer->x >> grid->shift, grid->columns - 1)];
+    for (; b >= 0 && outer->rectOrder != REMOVED_RECT_ORDER;
+        b = grid->blocks[b].next) {
+      const maxRectsGridBlock *block = &grid->blocks[b];
+      for (j = 0; j < block->count; ++j) {
+        if (isContainedIn(outer, &rects[block->indices[j]])) {
+          outer->rectOrder = REMOVED_RECT_ORDER;
+          break;
         }
-        bestRect = loop;
-				bestNode = newRect;
-        newRect = 0;
-			}
-      if (newRect) {
-        freeRect(newRect);
       }
-      loop = loop->next;
     }
-    if (!bestNode) {
-      fprintf(stderr, "%s: %s\n", __FUNCTION__, "find bestRect failed");
+  }
+
+  for (i = firstNew; i < ctx->freeRects->count; ++i) {
+    if (rects[i].rectOrder == REMOVED_RECT_ORDER) {
+      ++grid->deadRects;
+    } else if (0 != addToGrid(grid, &rects[i], i)) {
       return -1;
     }
-    if (bestNode->width != bestRect->width ||
-        bestNode->height != bestRect->height) {
-      bestNode->rectOrder = -bestRect->rectOrder;
+  }
+  return 0;
+}
+
+/// Cuts rect out of the free rects, leaving the maximal free rects around
+/// it.
+static int splitFreeRects(maxRectsContext *ctx, const maxRectsRect *rect) {
+  maxRectsRectArray *freeRects = ctx->freeRects;
+  maxRectsRectArray *split = ctx->splitRects;
+  maxRectsGrid *grid = ctx->grid;
+  int firstNew;
+  int i;
+
+  if (!grid->valid || grid->deadRects > freeRects->count / 2) {
+    if (0 != rebuildGrid(ctx)) {
+      return -1;
+    }
+  }
+
+  // Only free rects sharing a cell with rect can intersect it. They are
+  // split in the order of a scan over the whole list from the back.
+  if (0 != collectOverlaps(grid, rect)) {
+    return -1;
+  }
+  // A split emits at most four rects per free rect.
+  split->count = 0;
+  if (0 != reserveRects(split, grid->foundCount * 4)) {
+    return -1;
+  }
+  for (i = 0; i < grid->foundCount; ++i) {
+    int index = grid->found[i];
+    if (splitFreeNode(ctx, &freeRects->data[index], rect)) {
+      removeFromGrid(grid, &freeRects->data[index], index);
+      freeRects->data[index].rectOrder = REMOVED_RECT_ORDER;
+      ++grid->deadRects;
+    }
+  }
+  if (0 != reserveRects(freeRects, freeRects->count + split->count)) {
+    return -1;
+  }
+  firstNew = freeRects->count;
+  memcpy(freeRects->data + freeRects->count, split->data,
+    sizeof(maxRectsRect) * split->count);
+  freeRects->count += split->count;
+
+  return pruneNewFreeRects(ctx, firstNew);
+}
+
+static int placeRect(maxRectsContext *ctx, const maxRectsRect *rect) {
+  if (0 != splitFreeRects(ctx, rect)) {
+    return -1;
+  }
+  pushRect(ctx->usedRects, rect->x, rect->y, rect->width, rect->height,
+    rect->rectOrder)->id = rect->id;
+  return addEdges(ctx, rect);
+}
+
+/// Scores the inputs in [begin, end) from the back, like the scan over all
+/// of them: a later input only wins with strictly lower scores. Inlined into
+/// one kernel per heuristic and rotation flag below, so neither is tested
+/// per rect.
+MAX_RECTS_INLINE void scoreInputsWith(maxRectsContext *ctx, int begin,
+    int end, enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsChoice *choice) {
+  int i;
+  choice->index = -1;
+  choice->score1 = INT_MAX;
+  choice->score2 = INT_MAX;
+  for (i = end - 1; i >= begin; --i) {
+    const maxRectsRect *input = &ctx->inputRects->data[i];
+    int score1 = 0;
+    int score2 = 0;
+    maxRectsRect newNode = scoreRect(ctx, input->width, input->height,
+      method, allowRotations, &score1, &score2);
+    if (score1 < choice->score1 ||
+        (score1 == choice->score1 && score2 < choice->score2)) {
+      choice->index = i;
+      choice->score1 = score1;
+      choice->score2 = score2;
+      choice->node = newNode;
+    }
+  }
+}
+
+#define MAX_RECTS_KERNEL(name, method, allowRotations) \
+  static void name(maxRectsContext *ctx, int begin, int end, \
+      maxRectsChoice *choice) { \
+    scoreInputsWith(ctx, begin, end, method, allowRotations, choice); \
+  }
+
+MAX_RECTS_KERNEL(scoreBestShortSideFit, rectBestShortSideFit, 0)
+MAX_RECTS_KERNEL(scoreBestShortSideFitRotated, rectBestShortSideFit, 1)
+MAX_RECTS_KERNEL(scoreBestLongSideFit, rectBestLongSideFit, 0)
+MAX_RECTS_KERNEL(scoreBestLongSideFitRotated, rectBestLongSideFit, 1)
+MAX_RECTS_KERNEL(scoreBestAreaFit, rectBestAreaFit, 0)
+MAX_RECTS_KERNEL(scoreBestAreaFitRotated, rectBestAreaFit, 1)
+MAX_RECTS_KERNEL(scoreBottomLeftRule, rectBottomLeftRule, 0)
+MAX_RECTS_KERNEL(scoreBottomLeftRuleRotated, rectBottomLeftRule, 1)
+MAX_RECTS_KERNEL(scoreContactPointRule, rectContactPointRule, 0)
+MAX_RECTS_KERNEL(scoreContactPointRuleRotated, rectContactPointRule, 1)
+
+/// Kernels by heuristic, without and with rotation.
+static void (*const scoreKernels[][2])(maxRectsContext *ctx, int begin,
+    int end, maxRectsChoice *choice) = {
+  { scoreBestShortSideFit, scoreBestShortSideFitRotated },
+  { scoreBestLongSideFit, scoreBestLongSideFitRotated },
+  { scoreBestAreaFit, scoreBestAreaFitRotated },
+  { scoreBottomLeftRule, scoreBottomLeftRuleRotated },
+  { scoreContactPointRule, scoreContactPointRuleRotated },
+};
+
+static void scoreSlice(void *data, int slice) {
+  maxRectsContext *ctx = (maxRectsContext *)data;
+  int count = ctx->inputRects->count;
+  ctx->scoreInputs(ctx, (int)((long long)count * slice / ctx->sliceCount),
+    (int)((long long)count * (slice + 1) / ctx->sliceCount),
+    &ctx->choices[slice]);
+}
+
+/// Picks the input to place next. Large steps are scored in slices on the
+/// parallel for; reducing the slices from the back with the same rule as the
+/// scan gives the input the serial scan picks, so layouts do not depend on
+/// the number of threads.
+static void chooseInput(maxRectsContext *ctx, maxRectsChoice *best) {
+  int count = ctx->inputRects->count;
+  long long work = (long long)count *
+    (ctx->freeRects->count - ctx->grid->deadRects);
+  int i;
+
+  ctx->sliceCount = MIN(MAX_RECTS_SLICES, count / MAX_RECTS_SLICE_INPUTS);
+  if (!ctx->parallelFor || work < MAX_RECTS_PARALLEL_WORK ||
+      ctx->sliceCount < 2) {
+    ctx->scoreInputs(ctx, 0, count, best);
+    return;
+  }
+
+  ctx->parallelFor(ctx->parallelUser, ctx->sliceCount, scoreSlice, ctx);
+  best->index = -1;
+  best->score1 = INT_MAX;
+  best->score2 = INT_MAX;
+  for (i = ctx->sliceCount - 1; i >= 0; --i) {
+    const maxRectsChoice *choice = &ctx->choices[i];
+    if (choice->index >= 0 && (choice->score1 < best->score1 ||
+        (choice->score1 == best->score1 && choice->score2 < best->score2))) {
+      *best = *choice;
+    }
+  }
+}
+
+static int startLayout(maxRectsContext *ctx) {
+  maxRectsRectArray *inputRects = ctx->inputRects;
+  int placed = 0;
+  while (inputRects->count) {
+    maxRectsChoice best;
+    int bestIndex;
+    maxRectsRect bestNode;
+    if (0 != syncFreeLanes(ctx)) {
+      return -1;
+    }
+    chooseInput(ctx, &best);
+    bestIndex = best.index;
+    // The rects left do not fit, which is how a full page shows.
+    if (bestIndex < 0) {
+      return -1;
+    }
+    bestNode = best.node;
+    if (bestNode.width != inputRects->data[bestIndex].width ||
+        bestNode.height != inputRects->data[bestIndex].height) {
+      bestNode.rectOrder = -inputRects->data[bestIndex].rectOrder;
     } else {
-      bestNode->rectOrder = bestRect->rectOrder;
+      bestNode.rectOrder = inputRects->data[bestIndex].rectOrder;
+    }
+    bestNode.id = inputRects->data[bestIndex].id;
+    if (0 != placeRect(ctx, &bestNode)) {
+      return -1;
+    }
+    removeRectAt(inputRects, bestIndex);
+    ++placed;
+    if (ctx->progress &&
+        0 != ctx->progress(ctx->progressUser, placed, ctx->rectCount)) {
+      return -2;
     }
-    placeRect(ctx, bestNode);
-    removeAndFreeRectFromInputRectLink(ctx, bestRect);
   }
   return 0;
 }
 
-static void fillResults(maxRectsContext *ctx) {
-  maxRectsRect *loop = ctx->usedRectLink;
-  while (loop) {
-    int index = abs(loop->rectOrder) - 1;
+/// Leaves inputRects holding the inputs kept in front of left and the ones
+/// from next on, the ones not placed, as startLayout() does.
+static void keepInputs(maxRectsRectArray *inputRects, int left, int next) {
+  memmove(&inputRects->data[left], &inputRects->data[next],
+    sizeof(maxRectsRect) * (inputRects->count - next));
+  inputRects->count = left + inputRects->count - next;
+}
+
+/// Places the inputs in their order, each at the best spot for it alone. One
+/// search of the free rects per input instead of scoring all that are left
+/// at every step. Inputs that do not fit stay in inputRects, and so do the
+/// ones not tried yet when it fails or is stopped.
+static int placeInOrder(maxRectsContext *ctx) {
+  maxRectsRectArray *inputRects = ctx->inputRects;
+  int placed = 0;
+  int left = 0;
+  int synced = 0;
+  int i;
+  for (i = 0; i < inputRects->count; ++i) {
+    maxRectsRect input = inputRects->data[i];
+    maxRectsChoice choice;
+    maxRectsRect node;
+    if (!synced) {
+      if (0 != syncFreeLanes(ctx)) {
+        keepInputs(inputRects, left, i);
+        return -1;
+      }
+      synced = 1;
+    }
+    ctx->scoreInputs(ctx, i, i + 1, &choice);
+    if (choice.index < 0) {
+      inputRects->data[left++] = input;
+      continue;
+    }
+    node = choice.node;
+    if (node.width != input.width || node.height != input.height) {
+      node.rectOrder = -input.rectOrder;
+    } else {
+      node.rectOrder = input.rectOrder;
+    }
+    node.id = input.id;
+    if (0 != placeRect(ctx, &node)) {
+      keepInputs(inputRects, left, i);
+      return -1;
+    }
+    synced = 0;
+    ++placed;
+    if (ctx->progress &&
+        0 != ctx->progress(ctx->progressUser, placed, ctx->rectCount)) {
+      keepInputs(inputRects, left, i + 1);
+      return -2;
+    }
+  }
+  inputRects->count = left;
+  return left ? -1 : 0;
+}
+
+static void fillResults(maxRectsContext *ctx, int firstUsed) {
+  int i;
+  for (i = firstUsed; i < ctx->usedRects->count; ++i) {
+    const maxRectsRect *used = &ctx->usedRects->data[i];
+    int index = abs(used->rectOrder) - 1;
     maxRectsPosition *result = &ctx->layoutResults[index];
-    result->left = loop->x;
-    result->top = loop->y;
-    result->rotated = loop->rectOrder < 0;
-    result->used             = 1;
-    loop = loop->next;
+    result->left = used->x;
+    result->top = used->y;
+    result->rotated = used->rectOrder < 0;
+    result->used = 1;
   }
 }
 
-int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
-    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
-    maxRectsPosition *layoutResults, float *occupancy) {
-  maxRectsContext contextStruct;
-  maxRectsContext *ctx = &contextStruct;
-  memset(ctx, 0, sizeof(maxRectsContext));
-  ctx->width = width;
-  ctx->height = height;
-  ctx->method = method;
-  ctx->allowRotations = allowRotations;
+static int insertRects(maxRectsContext *ctx, int rectCount,
+    maxRectsSize *rects, const int *ids, maxRectsPosition *layoutResults) {
+  int firstUsed = ctx->usedRects->count;
+  int result;
   ctx->rectCount = rectCount;
   ctx->rects = rects;
   ctx->layoutResults = layoutResults;
-  if (0 != initContext(ctx)) {
-    releaseContext(ctx);
+  if (0 != initInputs(ctx, ids)) {
     return -1;
   }
-  if (0 != startLayout(ctx))
-  {
-      fillResults(ctx);
-    releaseContext(ctx);
+  ctx->scoreInputs = scoreKernels[ctx->method >= rectBestShortSideFit &&
+    ctx->method <= rectContactPointRule ? ctx->method : rectBestShortSideFit]
+    [ctx->allowRotations ? 1 : 0];
+  result = ctx->online ? placeInOrder(ctx) : startLayout(ctx);
+  fillResults(ctx, firstUsed);
+  return result;
+}
+
+int maxRectsWithArena(maxRectsArena *arena, int width, int height,
+    int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  maxRectsContext contextStruct;
+  maxRectsContext *ctx = &contextStruct;
+  int result;
+  bindContext(ctx, arena, width, height, method, allowRotations);
+  if (0 != clearContext(ctx)) {
     return -1;
   }
-  if (occupancy) {
+  result = insertRects(ctx, rectCount, rects, 0, layoutResults);
+  if (0 == result && occupancy) {
     *occupancy = getOccupany(ctx);
   }
-  fillResults(ctx);
-  releaseContext(ctx);
+  return result;
+}
+
+int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, float *occupancy) {
+  int result;
+  maxRectsArena *arena = maxRectsArenaCreate();
+  if (!arena) {
+    return -1;
+  }
+  result = maxRectsWithArena(arena, width, height, rectCount, rects, method,
+    allowRotations, layoutResults, occupancy);
+  maxRectsArenaDestroy(arena);
+  return result;
+}
+
+/// The freed space can join free rects anywhere around it into larger ones,
+/// so after removals the free list is derived again from the whole bin and
+/// the used rects left, with the splits of the grid. That keeps it the set
+/// of all maximal free rects, which inserts score against and
+/// maxRectsBinPlace() relies on. Removals only mark the list stale, so any
+/// number of them in a row share one rebuild before the next insert or
+/// place.
+static int refreshFreeRects(maxRectsBin *bin, maxRectsContext *ctx) {
+  int i;
+  if (!bin->arena.staleFreeRects) {
+    return 0;
+  }
+  ctx->freeRects->count = 0;
+  ctx->grid->deadRects = 0;
+  ctx->grid->valid = 0;
+  if (0 != reserveRects(ctx->freeRects, 4 * ctx->usedRects->count + 16)) {
+    return -1;
+  }
+  pushRect(ctx->freeRects, 0, 0, ctx->width, ctx->height, 0);
+  for (i = 0; i < ctx->usedRects->count; ++i) {
+    if (0 != splitFreeRects(ctx, &ctx->usedRects->data[i])) {
+      return -1;
+    }
+  }
+  bin->arena.staleFreeRects = 0;
   return 0;
-}
\ No newline at end of file
+}
+
+maxRectsBin *maxRectsBinCreate(int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations) {
+  maxRectsBin *bin = (maxRectsBin *)calloc(1, sizeof(maxRectsBin));
+  if (!bin) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  if (0 != maxRectsBinReset(bin, width, height, method, allowRotations)) {
+    maxRectsBinDestroy(bin);
+    return 0;
+  }
+  return bin;
+}
+
+void maxRectsBinDestroy(maxRectsBin *bin) {
+  if (!bin) {
+    return;
+  }
+  releaseArena(&bin->arena);
+  free(bin);
+}
+
+int maxRectsBinReset(maxRectsBin *bin, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations) {
+  maxRectsContext ctx;
+  bin->width = width;
+  bin->height = height;
+  bin->method = method;
+  bin->allowRotations = allowRotations;
+  bindContext(&ctx, &bin->arena, width, height, method, allowRotations);
+  bin->arena.staleFreeRects = 0;
+  return clearContext(&ctx);
+}
+
+int maxRectsBinInsert(maxRectsBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  maxRectsContext ctx;
+  bindContext(&ctx, &bin->arena, bin->width, bin->height, bin->method,
+    bin->allowRotations);
+  if (0 != refreshFreeRects(bin, &ctx)) {
+    return -1;
+  }
+  return insertRects(&ctx, rectCount, rects, ids, layoutResults);
+}
+
+int maxRectsBinRemove(maxRectsBin *bin, int id) {
+  maxRectsContext ctx;
+  maxRectsRect freed;
+  int i;
+  bindContext(&ctx, &bin->arena, bin->width, bin->height, bin->method,
+    bin->allowRotations);
+  for (i = 0; i < ctx.usedRects->count; ++i) {
+    if (ctx.usedRects->data[i].id == id) {
+      break;
+    }
+  }
+  if (i == ctx.usedRects->count) {
+    return -1;
+  }
+  freed = ctx.usedRects->data[i];
+  removeRectAt(ctx.usedRects, i);
+  removeEdges(&ctx, &freed);
+  bin->arena.staleFreeRects = 1;
+  return 0;
+}
+
+int maxRectsBinPlace(maxRectsBin *bin, const maxRectsSize *size,
+    const maxRectsPosition *position, int id) {
+  maxRectsContext ctx;
+  maxRectsRect rect;
+  int i;
+  bindContext(&ctx, &bin->arena, bin->width, bin->height, bin->method,
+    bin->allowRotations);
+  rect.x = position->left;
+  rect.y = position->top;
+  rect.width = position->rotated ? size->height : size->width;
+  rect.height = position->rotated ? size->width : size->height;
+  rect.rectOrder = 0;
+  rect.id = id;
+  if (rect.width <= 0 || rect.height <= 0 ||
+      0 != refreshFreeRects(bin, &ctx)) {
+    return -1;
+  }
+
+  // Free space that takes the rect lies within one of the free rects.
+  for (i = 0; i < ctx.freeRects->count; ++i) {
+    if (ctx.freeRects->data[i].rectOrder != REMOVED_RECT_ORDER &&
+        isContainedIn(&rect, &ctx.freeRects->data[i])) {
+      break;
+    }
+  }
+  if (i == ctx.freeRects->count) {
+    return -1;
+  }
+  if (0 != reserveRects(ctx.usedRects, ctx.usedRects->count + 1)) {
+    return -1;
+  }
+  return placeRect(&ctx, &rect);
+}
+
+void maxRectsBinSetProgress(maxRectsBin *bin, maxRectsProgress progress,
+    void *user) {
+  maxRectsArenaSetProgress(&bin->arena, progress, user);
+}
+
+void maxRectsBinSetParallel(maxRectsBin *bin, maxRectsParallelFor parallelFor,
+    void *user) {
+  maxRectsArenaSetParallel(&bin->arena, parallelFor, user);
+}
+
+void maxRectsBinSetOnline(maxRectsBin *bin, int online) {
+  maxRectsArenaSetOnline(&bin->arena, online);
+}
+
+float maxRectsBinOccupancy(maxRectsBin *bin) {
+  maxRectsContext ctx;
+  bindContext(&ctx, &bin->arena, bin->width, bin->height, bin->method,
+    bin->allowRotations);
+  return getOccupany(&ctx);
+}
@@ -32,8 +32,98 @@ enum maxRectsFreeRectChoiceHeuristic {
   rectContactPointRule ///< -CP: Choosest the placement where the rectangle touches other rects as much as possible.
 };
 
+/// Scratch storage for the packer. Keep one around and pass it to
+/// maxRectsWithArena() so repeated packs reuse the same buffers instead of
+/// allocating per rect.
+typedef struct maxRectsArena maxRectsArena;
+
+maxRectsArena *maxRectsArenaCreate(void);
+void maxRectsArenaDestroy(maxRectsArena *arena);
+
+/// Called after every rect the packer places, with the number of rects
+/// placed so far by the current call and the number it was given. A non-zero
+/// return stops the call, which then returns -2; the rects placed up to
+/// there keep their results.
+typedef int (*maxRectsProgress)(void *user, int placed, int total);
+
+/// Installs progress (may be null) for every later pack with this arena.
+void maxRectsArenaSetProgress(maxRectsArena *arena, maxRectsProgress progress,
+    void *user);
+
+typedef void (*maxRectsTask)(void *data, int index);
+
+/// Runs task(data, index) for every index in [0, taskCount), on any number
+/// of threads, and returns once all of them are done.
+typedef void (*maxRectsParallelFor)(void *user, int taskCount,
+    maxRectsTask task, void *data);
+
+/// Installs parallelFor (may be null) for every later pack with this arena.
+/// Steps with many rects left then score them in slices on it. The layout is
+/// the one of a pack without it, ties still go to the same rect.
+void maxRectsArenaSetParallel(maxRectsArena *arena,
+    maxRectsParallelFor parallelFor, void *user);
+
+/// With online set, later packs with this arena place the rects one by one in
+/// the order given, each at the best spot the heuristic finds for it, instead
+/// of picking the best of all rects left at every step. That is one search of
+/// the free rects per rect rather than one per rect left, for somewhat looser
+/// layouts; sort the rects largest first (by area, max side or height).
+void maxRectsArenaSetOnline(maxRectsArena *arena, int online);
+
+int maxRectsWithArena(maxRectsArena *arena, int width, int height,
+    int rectCount, maxRectsSize *rects,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
+    maxRectsPosition *layoutResults, float *occupancy);
+
 int maxRects(int width, int height, int rectCount, maxRectsSize *rects,
     enum maxRectsFreeRectChoiceHeuristic method, int allowRotations,
     maxRectsPosition *layoutResults, float *occupancy);
 
+/// A bin that keeps its free and used rects between calls, so sprites can be
+/// inserted into the remaining space or removed again without relaying out
+/// the ones that are already placed.
+typedef struct maxRectsBin maxRectsBin;
+
+maxRectsBin *maxRectsBinCreate(int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations);
+void maxRectsBinDestroy(maxRectsBin *bin);
+
+/// Empties the bin and applies new settings.
+int maxRectsBinReset(maxRectsBin *bin, int width, int height,
+    enum maxRectsFreeRectChoiceHeuristic method, int allowRotations);
+
+/// Places rects into the free space. ids (may be null, then the index is used)
+/// are remembered for maxRectsBinRemove(). Only the entries of layoutResults
+/// that were placed are written. Returns -1 when some rects did not fit and
+/// -2 when the progress callback stopped it.
+int maxRectsBinInsert(maxRectsBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults);
+
+/// Gives the space of a previously inserted rect back to the bin. The free
+/// space is worked out again once, at the next insert or place, however many
+/// rects were removed before it.
+int maxRectsBinRemove(maxRectsBin *bin, int id);
+
+/// Puts a rect of the given size at position, as if an insert had chosen
+/// that spot, so a layout can be rebuilt. Returns -1 when the spot is not
+/// entirely free.
+int maxRectsBinPlace(maxRectsBin *bin, const maxRectsSize *size,
+    const maxRectsPosition *position, int id);
+
+/// Installs progress (may be null) for later inserts into the bin. A stopped
+/// insert, online or not, leaves the bin holding the rects placed until then
+/// and ready for the next insert.
+void maxRectsBinSetProgress(maxRectsBin *bin, maxRectsProgress progress,
+    void *user);
+
+/// Installs parallelFor (may be null) for later inserts into the bin.
+void maxRectsBinSetParallel(maxRectsBin *bin, maxRectsParallelFor parallelFor,
+    void *user);
+
+/// Switches later inserts into the bin to online placement, see
+/// maxRectsArenaSetOnline().
+void maxRectsBinSetOnline(maxRectsBin *bin, int online);
+
+float maxRectsBinOccupancy(maxRectsBin *bin);
+
 #endif
\ No newline at end of file
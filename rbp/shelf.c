@@ -0,0 +1,149 @@
+/*
+  Streaming shelf bin.
+*/
+#include "shelf.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+typedef struct shelfPlaced {
+  int id;
+  long long area;
+} shelfPlaced;
+
+struct shelfBin {
+  int width;
+  int height;
+  int allowRotations;
+  int shelfX;
+  int shelfY;
+  int shelfHeight;
+  shelfPlaced *placed;
+  int placedCount;
+  int placedCapacity;
+  long long usedArea;
+};
+
+static int reservePlaced(shelfBin *bin, int count) {
+  shelfPlaced *placed;
+  int capacity;
+  if (count <= bin->placedCapacity) {
+    return 0;
+  }
+  capacity = bin->placedCapacity ? bin->placedCapacity * 2 : 64;
+  if (capacity < count) {
+    capacity = count;
+  }
+  placed = (shelfPlaced *)realloc(bin->placed,
+    (size_t)capacity * sizeof(shelfPlaced));
+  if (!placed) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  bin->placed = placed;
+  bin->placedCapacity = capacity;
+  return 0;
+}
+
+shelfBin *shelfBinCreate(int width, int height, int allowRotations) {
+  shelfBin *bin = (shelfBin *)calloc(1, sizeof(shelfBin));
+  if (!bin) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  if (0 != shelfBinReset(bin, width, height, allowRotations)) {
+    shelfBinDestroy(bin);
+    return 0;
+  }
+  return bin;
+}
+
+void shelfBinDestroy(shelfBin *bin) {
+  if (!bin) {
+    return;
+  }
+  free(bin->placed);
+  free(bin);
+}
+
+int shelfBinReset(shelfBin *bin, int width, int height, int allowRotations) {
+  if (width <= 0 || height <= 0) {
+    return -1;
+  }
+  bin->width = width;
+  bin->height = height;
+  bin->allowRotations = allowRotations;
+  bin->shelfX = 0;
+  bin->shelfY = 0;
+  bin->shelfHeight = 0;
+  bin->placedCount = 0;
+  bin->usedArea = 0;
+  return 0;
+}
+
+int shelfBinInsert(shelfBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  int i;
+  if (0 != reservePlaced(bin, bin->placedCount + rectCount)) {
+    return 0;
+  }
+  for (i = 0; i < rectCount; ++i) {
+    int width = rects[i].width;
+    int height = rects[i].height;
+    int rotated = 0;
+    shelfPlaced *placed;
+
+    if (bin->allowRotations && height > width && height <= bin->width) {
+      width = rects[i].height;
+      height = rects[i].width;
+      rotated = 1;
+    }
+    if (width > bin->width || height > bin->height) {
+      continue;
+    }
+
+    // A rect that does not fit the rest of the row, or is taller than the
+    // row, starts the next one.
+    if (bin->shelfX &&
+        (bin->shelfX + width > bin->width || height > bin->shelfHeight)) {
+      bin->shelfY += bin->shelfHeight;
+      bin->shelfX = 0;
+      bin->shelfHeight = 0;
+    }
+    // The first rect of a row sets its height.
+    if (!bin->shelfX) {
+      if (bin->shelfY + height > bin->height) {
+        return i;
+      }
+      bin->shelfHeight = height;
+    }
+
+    layoutResults[i].left = bin->shelfX;
+    layoutResults[i].top = bin->shelfY;
+    layoutResults[i].rotated = rotated;
+    layoutResults[i].used = 1;
+    bin->shelfX += width;
+
+    placed = &bin->placed[bin->placedCount++];
+    placed->id = ids ? ids[i] : i;
+    placed->area = (long long)width * height;
+    bin->usedArea += placed->area;
+  }
+  return rectCount;
+}
+
+int shelfBinRemove(shelfBin *bin, int id) {
+  int i;
+  for (i = 0; i < bin->placedCount; ++i) {
+    if (bin->placed[i].id == id) {
+      bin->usedArea -= bin->placed[i].area;
+      bin->placed[i] = bin->placed[--bin->placedCount];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+float shelfBinOccupancy(shelfBin *bin) {
+  return (float)((double)bin->usedArea /
+    ((double)bin->width * bin->height));
+}
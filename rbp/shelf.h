@@ -0,0 +1,38 @@
+/*
+  Streaming shelf bin: rects are laid out left to right on rows, and a new row
+  is opened on top of the last one when a rect no longer fits.
+  Uses the same size and position types as maxrects.h.
+*/
+
+#ifndef SHELF_H
+#define SHELF_H
+
+#include "maxrects.h"
+
+/// A bin that only remembers its current row, so it costs the same no matter
+/// how many rects it holds. Rows are never revisited, removed rects only stop
+/// counting towards the occupancy until the next reset.
+typedef struct shelfBin shelfBin;
+
+shelfBin *shelfBinCreate(int width, int height, int allowRotations);
+void shelfBinDestroy(shelfBin *bin);
+
+/// Empties the bin and applies new settings.
+int shelfBinReset(shelfBin *bin, int width, int height, int allowRotations);
+
+/// Places rects in the given order, best sorted by decreasing height. With
+/// allowRotations, rects are laid on their long side when that fits the bin
+/// width. Stops at the first rect that needs a row past the bottom of the bin
+/// and returns how many rects were consumed; rects larger than the whole bin
+/// are consumed without being placed. ids (may be null, then the index is
+/// used) are remembered for shelfBinRemove(). Only the entries of
+/// layoutResults that were placed are written.
+int shelfBinInsert(shelfBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults);
+
+/// Forgets a previously inserted rect.
+int shelfBinRemove(shelfBin *bin, int id);
+
+float shelfBinOccupancy(shelfBin *bin);
+
+#endif
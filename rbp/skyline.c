@@ -0,0 +1,158 @@
+/*
+  Skyline bin built on stb_rect_pack from raylib/src/external.
+*/
+#include "skyline.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// raylib exports its own copy of stb_rect_pack, keep this one private.
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "external/stb_rect_pack.h"
+
+typedef struct skylinePlaced {
+  int id;
+  long long area;
+} skylinePlaced;
+
+struct skylineBin {
+  int width;
+  int height;
+  enum skylineHeuristic method;
+  int allowRotations;
+  stbrp_context context;
+  stbrp_node *nodes;
+  int nodeCapacity;
+  stbrp_rect *inputRects;
+  int inputCapacity;
+  skylinePlaced *placed;
+  int placedCount;
+  int placedCapacity;
+  long long usedArea;
+};
+
+static int reserveMemory(void **data, int *capacity, int count, size_t size) {
+  void *grown;
+  int newCapacity;
+  if (count <= *capacity) {
+    return 0;
+  }
+  newCapacity = *capacity ? *capacity * 2 : 64;
+  if (newCapacity < count) {
+    newCapacity = count;
+  }
+  grown = realloc(*data, (size_t)newCapacity * size);
+  if (!grown) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "realloc failed");
+    return -1;
+  }
+  *data = grown;
+  *capacity = newCapacity;
+  return 0;
+}
+
+skylineBin *skylineBinCreate(int width, int height,
+    enum skylineHeuristic method, int allowRotations) {
+  skylineBin *bin = (skylineBin *)calloc(1, sizeof(skylineBin));
+  if (!bin) {
+    fprintf(stderr, "%s: %s\n", __FUNCTION__, "calloc failed");
+    return 0;
+  }
+  if (0 != skylineBinReset(bin, width, height, method, allowRotations)) {
+    skylineBinDestroy(bin);
+    return 0;
+  }
+  return bin;
+}
+
+void skylineBinDestroy(skylineBin *bin) {
+  if (!bin) {
+    return;
+  }
+  free(bin->nodes);
+  free(bin->inputRects);
+  free(bin->placed);
+  free(bin);
+}
+
+int skylineBinReset(skylineBin *bin, int width, int height,
+    enum skylineHeuristic method, int allowRotations) {
+  if (width <= 0 || height <= 0) {
+    return -1;
+  }
+  // One node per column lets stb_rect_pack keep every skyline step.
+  if (0 != reserveMemory((void **)&bin->nodes, &bin->nodeCapacity, width,
+      sizeof(stbrp_node))) {
+    return -1;
+  }
+  bin->width = width;
+  bin->height = height;
+  bin->method = method;
+  bin->allowRotations = allowRotations;
+  bin->placedCount = 0;
+  bin->usedArea = 0;
+  stbrp_init_target(&bin->context, width, height, bin->nodes, width);
+  stbrp_setup_heuristic(&bin->context, skylineBestFit == method ?
+    STBRP_HEURISTIC_Skyline_BF_sortHeight :
+    STBRP_HEURISTIC_Skyline_BL_sortHeight);
+  return 0;
+}
+
+int skylineBinInsert(skylineBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults) {
+  int failed = 0;
+  int i;
+  if (0 != reserveMemory((void **)&bin->inputRects, &bin->inputCapacity,
+      rectCount, sizeof(stbrp_rect)) ||
+      0 != reserveMemory((void **)&bin->placed, &bin->placedCapacity,
+      bin->placedCount + rectCount, sizeof(skylinePlaced))) {
+    return -1;
+  }
+
+  for (i = 0; i < rectCount; ++i) {
+    stbrp_rect *input = &bin->inputRects[i];
+    int rotated = bin->allowRotations && rects[i].height > rects[i].width;
+    input->id = i;
+    input->w = rotated ? rects[i].height : rects[i].width;
+    input->h = rotated ? rects[i].width : rects[i].height;
+  }
+
+  stbrp_pack_rects(&bin->context, bin->inputRects, rectCount);
+
+  for (i = 0; i < rectCount; ++i) {
+    const stbrp_rect *input = &bin->inputRects[i];
+    skylinePlaced *placed;
+    if (!input->was_packed) {
+      failed = 1;
+      continue;
+    }
+    layoutResults[i].left = input->x;
+    layoutResults[i].top = input->y;
+    layoutResults[i].rotated = input->w != rects[i].width ||
+      input->h != rects[i].height;
+    layoutResults[i].used = 1;
+
+    placed = &bin->placed[bin->placedCount++];
+    placed->id = ids ? ids[i] : i;
+    placed->area = (long long)input->w * input->h;
+    bin->usedArea += placed->area;
+  }
+  return failed ? -1 : 0;
+}
+
+int skylineBinRemove(skylineBin *bin, int id) {
+  int i;
+  for (i = 0; i < bin->placedCount; ++i) {
+    if (bin->placed[i].id == id) {
+      bin->usedArea -= bin->placed[i].area;
+      bin->placed[i] = bin->placed[--bin->placedCount];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+float skylineBinOccupancy(skylineBin *bin) {
+  return (float)((double)bin->usedArea /
+    ((double)bin->width * bin->height));
+}
@@ -0,0 +1,42 @@
+/*
+  Skyline bin built on stb_rect_pack from raylib/src/external.
+  Uses the same size and position types as maxrects.h.
+*/
+
+#ifndef SKYLINE_H
+#define SKYLINE_H
+
+#include "maxrects.h"
+
+enum skylineHeuristic {
+  skylineBottomLeft, ///< -BL: Places the rect where its top ends up the lowest.
+  skylineBestFit ///< -BF: Places the rect where it wastes the least area below it.
+};
+
+/// A bin that keeps its skyline between calls, like maxRectsBin. The skyline
+/// cannot give space back, so removed rects only stop counting towards the
+/// occupancy until the next reset.
+typedef struct skylineBin skylineBin;
+
+skylineBin *skylineBinCreate(int width, int height,
+    enum skylineHeuristic method, int allowRotations);
+void skylineBinDestroy(skylineBin *bin);
+
+/// Empties the bin and applies new settings.
+int skylineBinReset(skylineBin *bin, int width, int height,
+    enum skylineHeuristic method, int allowRotations);
+
+/// Places rects on the skyline. With allowRotations, rects taller than wide
+/// are laid down on their side, which keeps the skyline low. ids (may be null,
+/// then the index is used) are remembered for skylineBinRemove(). Only the
+/// entries of layoutResults that were placed are written. Returns -1 when
+/// some rects did not fit.
+int skylineBinInsert(skylineBin *bin, int rectCount, maxRectsSize *rects,
+    const int *ids, maxRectsPosition *layoutResults);
+
+/// Forgets a previously inserted rect.
+int skylineBinRemove(skylineBin *bin, int id);
+
+float skylineBinOccupancy(skylineBin *bin);
+
+#endif
@@ -2,6 +2,57 @@
 
 namespace box
 {
+    static const char* heuristic_names[pack_heuristic_count] = {
+        "BestShortSideFit",
+        "BestLongSideFit",
+        "BestAreaFit",
+        "BottomLeftRule",
+        "ContactPointRule",
+        "Auto (best of all)",
+        "Skyline BottomLeft",
+        "Skyline BestFit",
+        "Guillotine BestAreaFit",
+        "Guillotine BestShortSideFit",
+        "Guillotine BestLongSideFit",
+        "Shelf (streaming)",
+    };
+
+    // Hash of the image data, to find sprites showing the same image. Pixels
+    // are compared as well before two sprites share a region.
+    static uint64_t pixel_hash(const Image& img)
+    {
+        uint64_t key = 0xcbf29ce484222325ull;
+        for (int64_t value : {int64_t(img.width), int64_t(img.height), int64_t(img.format)})
+        {
+            key = layout_cache::hash(key, value);
+        }
+        if (!img.data)
+            return key;
+
+        const auto* bytes = (const unsigned char*)img.data;
+        const auto  size  = (size_t)GetPixelDataSize(img.width, img.height, img.format);
+        size_t      n     = 0;
+        for (; n + 8 <= size; n += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + n, 8);
+            key = (key ^ word) * 0x100000001b3ull;
+            key ^= key >> 29;
+        }
+        for (; n < size; ++n)
+        {
+            key = (key ^ bytes[n]) * 0x100000001b3ull;
+        }
+        return key;
+    }
+
+    static bool same_pixels(const Image& a, const Image& b)
+    {
+        if (a.width != b.width || a.height != b.height || a.format != b.format || !a.data || !b.data)
+            return false;
+        return 0 == std::memcmp(a.data, b.data, (size_t)GetPixelDataSize(a.width, a.height, a.format));
+    }
+
     app::app(properties_t& props) : _props(props)
     {
         auto img = GenImageColor(2, 2, WHITE);
@@ -22,6 +73,7 @@ namespace box
         show_texture();
         show_list();
         show_composition();
+        show_benchmark();
 
         if (IsFileDropped())
         {
@@ -33,14 +85,11 @@ namespace box
             }
 
             UnloadDroppedFiles(droppedFiles); // Unload filepaths from memory
-            _dirty = true;
         }
 
-        if (_dirty)
-        {
-            _dirty = false;
-            repack();
-        }
+        apply_changes();
+        if (_worker.fetch(_layout))
+            apply_layout();
     }
 
     void app::show_menu()
@@ -99,6 +148,34 @@ namespace box
                 ImGui::EndMenu();
             }
 
+            if (ImGui::BeginMenu("Tools"))
+            {
+                if (ImGui::MenuItem("Benchmark engines", nullptr, false, !_items.empty()))
+                {
+                    benchmark();
+                    _show_benchmark = true;
+                }
+                if (ImGui::MenuItem("Export sprite sizes", nullptr, false, !_items.empty()))
+                {
+                    char const* size_patterns[1] = {"*.txt"};
+                    if (auto file = tinyfd_saveFileDialog("Export Sprite Sizes", "sizes.txt", 1, size_patterns, "Size list"))
+                    {
+                        save_sizes(file);
+                    }
+                }
+                if (ImGui::MenuItem("Check save round trip"))
+                {
+                    const auto ok = check_round_trip();
+                    tinyfd_messageBox("Check save round trip",
+                                      ok ? "The opened atlas matches the saved one."
+                                         : "The opened atlas differs from the saved one.",
+                                      "ok",
+                                      ok ? "info" : "error",
+                                      1);
+                }
+                ImGui::EndMenu();
+            }
+
             ImGui::EndMainMenuBar();
         }
     }
@@ -161,54 +238,191 @@ namespace box
                               ImGuiTableFlags_NoBordersInBodyUntilResize | ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY,
                               {-1, 220}))
         {
+            ItemLabel("Auto size");
+            if (ImGui::Checkbox("##asz", &_auto_size))
+            {
+                _changes    |= app_change::Layout;
+                _full_repack = true;
+            }
+
+            if (_auto_size)
+            {
+                ItemLabel("Max size");
+                if (ImGui::DragInt("##msz", &_size_limits._max_size))
+                {
+                    _size_limits._max_size = _size_limits._max_size > 0 ? _size_limits._max_size : 1;
+                    _changes              |= app_change::Layout;
+                }
+
+                ItemLabel("Power of two");
+                if (ImGui::Checkbox("##pot", &_size_limits._power_of_two))
+                {
+                    _changes |= app_change::Layout;
+                }
+
+                ItemLabel("Square");
+                if (ImGui::Checkbox("##sqr", &_size_limits._square))
+                {
+                    _changes |= app_change::Layout;
+                }
+
+                ItemLabel("Multiple of 4");
+                if (ImGui::Checkbox("##mu4", &_size_limits._multiple_of_4))
+                {
+                    _changes |= app_change::Layout;
+                }
+            }
+
+            ImGui::BeginDisabled(_auto_size);
             ItemLabel("Texture width");
             if (ImGui::DragInt("##tsw", &_width))
             {
-                _width = _width > 0 ? _width : 1;
-                _dirty  = true;
+                _width       = _width > 0 ? _width : 1;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
 
             ItemLabel("Texture height");
             if (ImGui::DragInt("##tsh", &_height))
             {
-                _height = _height > 0 ? _height : 1;
-                _dirty = true;
+                _height      = _height > 0 ? _height : 1;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
+            ImGui::EndDisabled();
 
             ItemLabel("Padding");
             if (ImGui::DragInt("##pd", &_padding))
             {
-                _padding = _padding > 0 ? _padding : 0;
-                _dirty   = true;
+                _padding     = _padding > 0 ? _padding : 0;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
 
             ItemLabel("Spacing");
             if (ImGui::DragInt("##sp", &_spacing))
             {
-                _spacing = _spacing > 0 ? _spacing : 0;
-                _dirty   = true;
+                _spacing     = _spacing > 0 ? _spacing : 0;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
 
+            const char* blocks = "None\0"
+                                 "4x4\0"
+                                 "8x8\0"
+                                 "16x16\0";
+            int32_t block = _block_align >= 16 ? 3 : _block_align >= 8 ? 2 : _block_align >= 4 ? 1 : 0;
+
+            ItemLabel("Block align");
+            if (ImGui::Combo("##bal", &block, blocks))
+            {
+                _block_align = block ? 2 << block : 1;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
+            }
+
+            ItemLabel("Mip levels");
+            if (ImGui::SliderInt("##mip", &_mip_levels, 0, 8))
+            {
+                _mip_levels  = std::clamp(_mip_levels, 0, 8);
+                _changes    |= app_change::Layout;
+                _full_repack = true;
+            }
 
-            const char* options =
-                "BestShortSideFit\0"
-                "BestLongSideFit\0"
-                "BestAreaFit\0"
-                "BottomLeftRule\0"
-                "ContactPointRule\0";
 
             ItemLabel("Packing algorithm");
-            if (ImGui::Combo("##hr", &_heuristic, options))
+            if (ImGui::Combo("##hr", &_heuristic, heuristic_names, pack_heuristic_count))
             {
-                _dirty = true;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
 
-            ItemLabel("Trim size");
-            if (ImGui::Checkbox("##trt", &_trim))
+            if (_heuristic == pack_heuristic_auto)
+            {
+                const char* orders[] = {"input", "area", "max side", "perimeter", "height"};
+
+                ItemLabel("Best layout");
+                ImGui::Text("%s, %s", heuristic_names[_layout._heuristic], orders[_layout._order]);
+            }
+
+            if ((_heuristic >= pack_guillotine_area && _heuristic <= pack_guillotine_long) ||
+                _heuristic == pack_heuristic_auto)
+            {
+                const char* splits = "Shorter leftover axis\0"
+                                     "Longer leftover axis\0";
+                int32_t split = (_pack_options & pack_guillotine_longer_split) ? 1 : 0;
+
+                ItemLabel("Guillotine split");
+                if (ImGui::Combo("##gsp", &split, splits))
+                {
+                    _pack_options = split ? _pack_options | pack_guillotine_longer_split
+                                          : _pack_options & ~pack_guillotine_longer_split;
+                    _changes    |= app_change::Layout;
+                    _full_repack = true;
+                }
+
+                ItemLabel("Merge free rects");
+                if (ImGui::CheckboxFlags("##gmr", &_pack_options, pack_guillotine_merge))
+                {
+                    _changes    |= app_change::Layout;
+                    _full_repack = true;
+                }
+            }
+
+            if (_heuristic < pack_heuristic_auto)
+            {
+                const char* orders[] = {"input", "area", "max side", "perimeter", "height"};
+
+                ItemLabel("Fast editing");
+                if (ImGui::Checkbox("##onl", &_online_packing))
+                {
+                    _changes    |= app_change::Layout;
+                    _full_repack = true;
+                }
+
+                if (_online_packing)
+                {
+                    ItemLabel("Placement order");
+                    if (ImGui::Combo("##ono", &_online_order, orders, (int)std::size(orders)))
+                    {
+                        _changes    |= app_change::Layout;
+                        _full_repack = true;
+                    }
+                }
+            }
+
+            ItemLabel("Repack below");
+            if (ImGui::SliderFloat("##rpt", &_repack_threshold, 0.f, 1.f, "%.2f of last repack"))
+            {
+                _repack_threshold = std::clamp(_repack_threshold, 0.f, 1.f);
+            }
+
+            ItemLabel("Stable layout");
+            ImGui::Checkbox("##stl", &_stable_layout);
+
+            ItemLabel("Allow rotation");
+            if (ImGui::Checkbox("##rot", &_allow_rotation))
+            {
+                _changes    |= app_change::Layout;
+                _full_repack = true;
+            }
+
+            ItemLabel("Grid same sizes");
+            if (ImGui::CheckboxFlags("##grd", &_pack_options, pack_grid_runs))
             {
-                _dirty = true;
+                _changes    |= app_change::Layout;
+                _full_repack = true;
             }
 
+            ItemLabel("Share duplicates");
+            if (ImGui::Checkbox("##dup", &_share_duplicates))
+            {
+                _changes |= app_change::Layout;
+            }
+
+            ItemLabel("Trim size");
+            ImGui::Checkbox("##trt", &_trim);
+
             ItemLabel("Embed texture");
             if (ImGui::Checkbox("##emb", &_embed))
             {
@@ -216,6 +430,21 @@ namespace box
 
             ImGui::EndTable();
         }
+
+        if (ImGui::Button("Repack", {-1, 0}))
+        {
+            _changes    |= app_change::Layout;
+            _full_repack = true;
+        }
+
+        if (_worker.busy())
+        {
+            ImGui::ProgressBar(_worker.progress(), {-1, 0}, "Packing");
+        }
+        else
+        {
+            ImGui::Text("Moved %d sprites, %d duplicates shared", _moved, _aliases);
+        }
     }
 
     static void ItemLabel(const char* label)
@@ -381,6 +610,44 @@ namespace box
                 ItemLabel("Right");
                 ImGui::DragInt("##soxb", &_active->_oxb);
             }
+
+            ItemLabel("Pinned");
+            if (ImGui::Checkbox("##spn", &_active->_pinned))
+            {
+                // Starts out where the sprite is now.
+                if (_active->_pinned && _active->_packed)
+                {
+                    _active->_pin_x    = (int32_t)_active->_region.x;
+                    _active->_pin_y    = (int32_t)_active->_region.y;
+                    _active->_pin_page = _active->_page;
+                }
+                _changes |= app_change::Layout;
+            }
+            if (_active->_pinned)
+            {
+                ItemLabel("Pin X");
+                if (ImGui::DragInt("##spx", &_active->_pin_x, 1.f, 0, _width))
+                {
+                    _changes |= app_change::Layout;
+                }
+                ItemLabel("Pin Y");
+                if (ImGui::DragInt("##spy", &_active->_pin_y, 1.f, 0, _height))
+                {
+                    _changes |= app_change::Layout;
+                }
+                ItemLabel("Pin page");
+                if (ImGui::InputInt("##spp", &_active->_pin_page))
+                {
+                    _active->_pin_page = std::clamp(_active->_pin_page, 0, (int32_t)_pages.size());
+                    _changes          |= app_change::Layout;
+                }
+            }
+
+            if (const auto* owner = find_alias_owner(_active))
+            {
+                ItemLabel("Same image as");
+                ImGui::Text("%s", get_sprite_id(owner).data());
+            }
             ImGui::EndTable();
         }
     }
@@ -392,13 +659,11 @@ namespace box
         if (ImGui::Button(ICON_FA_FOLDER_PLUS))
         {
             add_files();
-            _dirty = true;
         }
         ImGui::SameLine();
         if (ImGui::Button(ICON_FA_FOLDER_MINUS))
         {
             remove_file(_active);
-            _dirty = true;
         }
 
         ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, {0, 15});
@@ -433,7 +698,10 @@ namespace box
                 ImGui::Image((ImTextureID)&spr.second._txt,
                              ImVec2(scle * spr.second._txt.width, scle * spr.second._txt.height));
                 ImGui::SameLine(ico.x + 10);
-                ImGui::Text(TextFormat("%02d %s", index, spr.first.c_str()));
+                if (spr.second._alias)
+                    ImGui::Text(TextFormat("%02d %s " ICON_FA_LINK, index, spr.first.c_str()));
+                else
+                    ImGui::Text(TextFormat("%02d %s", index, spr.first.c_str()));
 
                 ImGui::PopStyleColor();
                 ImGui::PopID();
@@ -448,6 +716,45 @@ namespace box
         ImGui::End();
     }
 
+    void app::show_benchmark()
+    {
+        if (!_show_benchmark)
+            return;
+
+        if (ImGui::Begin("Benchmark", &_show_benchmark))
+        {
+            ImGui::Text("%d sprites, %d x %d pages", (int32_t)_items.size(), _width, _height);
+            if (ImGui::Button("Run again", {-1, 0}))
+            {
+                benchmark();
+            }
+
+            if (ImGui::BeginTable("##bench", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY))
+            {
+                ImGui::TableSetupColumn("Engine");
+                ImGui::TableSetupColumn("Time");
+                ImGui::TableSetupColumn("Pages");
+                ImGui::TableSetupColumn("Occupancy");
+                ImGui::TableHeadersRow();
+
+                for (auto& res : _benchmark)
+                {
+                    ImGui::TableNextRow();
+                    ImGui::TableSetColumnIndex(0);
+                    ImGui::Text(heuristic_names[res._heuristic]);
+                    ImGui::TableSetColumnIndex(1);
+                    ImGui::Text("%.2f ms", res._milliseconds);
+                    ImGui::TableSetColumnIndex(2);
+                    ImGui::Text("%d", (int32_t)res._pages);
+                    ImGui::TableSetColumnIndex(3);
+                    ImGui::Text("%.1f %%", res._occupancy * 100.f);
+                }
+                ImGui::EndTable();
+            }
+        }
+        ImGui::End();
+    }
+
     void app::show_composition()
     {
         ImGui::Begin("Compositions");
@@ -455,13 +762,11 @@ namespace box
         if (ImGui::Button(ICON_FA_FOLDER_PLUS))
         {
             add_composition("composite");
-            _dirty = true;
         }
         ImGui::SameLine();
         if (ImGui::Button(ICON_FA_FOLDER_MINUS))
         {
             remove_composition(_active_comp);
-            _dirty = true;
         }
 
         ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, {0, 15});
@@ -529,6 +834,18 @@ namespace box
                 canvas.CenterOnScreen(get_texture_size());
             }
 
+            if (!_composite_mode && _pages.size() > 1)
+            {
+                ImGui::SameLine();
+                if (ImGui::ArrowButton("##pgl", ImGuiDir_Left))
+                    _page = std::max(_page - 1, 0);
+                ImGui::SameLine();
+                ImGui::Text("Page %d / %d", _page + 1, (int32_t)_pages.size());
+                ImGui::SameLine();
+                if (ImGui::ArrowButton("##pgr", ImGuiDir_Right))
+                    _page = std::min(_page + 1, (int32_t)_pages.size() - 1);
+            }
+
             ImGui::SameLine();
             ImGui::Checkbox("Show origin", &_visible_origin);
             ImGui::SameLine();
@@ -636,14 +953,31 @@ namespace box
             for (auto& spr : _items)
             {
                 ++index;
-                if (!spr.second._packed)
+                if (!spr.second._packed || spr.second._page != _page)
                     continue;
                 bool isactive = _active == nullptr || _active == &spr.second;
 
-                const uint32_t al = isactive ? 0xffffffff : 0x5fffffff;
-                ImVec2         p1(spr.second._region.x, spr.second._region.y);
-                ImVec2 p2(spr.second._region.x + spr.second._region.width, spr.second._region.y + spr.second._region.height);
-                dc->AddImage((ImTextureID)&spr.second._txt, canvas.WorldToScreen(p1), canvas.WorldToScreen(p2), {0, 0}, {1, 1}, al);
+                const uint32_t al   = isactive ? 0xffffffff : 0x5fffffff;
+                const auto     rect = spr.second.get_atlas_rect();
+                ImVec2         p1(rect.x, rect.y);
+                ImVec2         p2(rect.x + rect.width, rect.y + rect.height);
+                if (spr.second._rotated)
+                {
+                    dc->AddImageQuad((ImTextureID)&spr.second._txt,
+                                     canvas.WorldToScreen(p1),
+                                     canvas.WorldToScreen({p2.x, p1.y}),
+                                     canvas.WorldToScreen(p2),
+                                     canvas.WorldToScreen({p1.x, p2.y}),
+                                     {0, 1},
+                                     {0, 0},
+                                     {1, 0},
+                                     {1, 1},
+                                     al);
+                }
+                else
+                {
+                    dc->AddImage((ImTextureID)&spr.second._txt, canvas.WorldToScreen(p1), canvas.WorldToScreen(p2), {0, 0}, {1, 1}, al);
+                }
 
                 auto clr = bgclr;
 
@@ -670,21 +1004,18 @@ namespace box
 
                 if (_visible_origin || _active == &spr.second)
                 {
-                    auto origin = canvas.WorldToScreen(p1 + ImVec2{float(spr.second._oxa), float(spr.second._oya)});
+                    const auto pa     = spr.second.to_atlas({spr.second._oxa, spr.second._oya});
+                    const auto pb     = spr.second.to_atlas({spr.second._oxb, spr.second._oyb});
+                    auto       origin = canvas.WorldToScreen({pa.x, pa.y});
                     origin -= ImVec2(1, 1);
-                    auto origin2 = canvas.WorldToScreen(p1 + ImVec2{float(spr.second._oxb), float(spr.second._oyb)});
+                    auto origin2 = canvas.WorldToScreen({pb.x, pb.y});
                     origin2 -= ImVec2(1, 1);
 
                     clr = flclr;
                     if (_active == &spr.second)
                     {
-                        _drag._hovered_active[0] = _mouse.distance_sqr({spr.second._region.x + spr.second._oxa,
-                                                                        spr.second._region.y + spr.second._oya}) <
-                                                   pow2(8 / canvas.zoom);
-
-                        _drag._hovered_active[1] = _mouse.distance_sqr({spr.second._region.x + spr.second._oxb,
-                                                                        spr.second._region.y + spr.second._oyb}) <
-                                                   pow2(8 / canvas.zoom);
+                        _drag._hovered_active[0] = _mouse.distance_sqr(pa) < pow2(8 / canvas.zoom);
+                        _drag._hovered_active[1] = _mouse.distance_sqr(pb) < pow2(8 / canvas.zoom);
 
                         if (_drag._hovered_active[0] || _drag._hovered_active[1])
                         {
@@ -704,8 +1035,8 @@ namespace box
                     }
                     if (spr.second._data == sprite_data::NinePatch)
                     {
-                        ImVec2 pp1 = canvas.WorldToScreen(p1 + ImVec2((float)spr.second._oxa, (float)spr.second._oya));
-                        ImVec2 pp2 = canvas.WorldToScreen(p1 + ImVec2((float)spr.second._oxb, (float)spr.second._oyb));
+                        ImVec2 pp1 = canvas.WorldToScreen({pa.x, pa.y});
+                        ImVec2 pp2 = canvas.WorldToScreen({pb.x, pb.y});
 
                         dc->AddRect(pp1, pp2, clr);
                         draw_origin(pp1, clr);
@@ -733,17 +1064,19 @@ namespace box
             if (IsMouseButtonDown(0) && (_drag._drag_active[0] || _drag._drag_active[1]))
             {
                 auto off = ImGui::GetMouseDragDelta(0);
+                auto pos = _drag._drag_origin->to_local(_drag._drag_origin->to_atlas(_drag._drag_begin) +
+                                                        point2f(off.x / canvas.zoom, off.y / canvas.zoom));
                 ImGui::BeginTooltip();
                 if (_drag._drag_active[0])
                 {
-                    _drag._drag_origin->_oxa = int32_t(_drag._drag_begin.x + off.x / canvas.zoom);
-                    _drag._drag_origin->_oya = int32_t(_drag._drag_begin.y + off.y / canvas.zoom);
+                    _drag._drag_origin->_oxa = int32_t(pos.x);
+                    _drag._drag_origin->_oya = int32_t(pos.y);
                     ImGui::Text("%d x %d", _drag._drag_origin->_oxa, _drag._drag_origin->_oya);
                 }
                 if (_drag._drag_active[1])
                 {
-                    _drag._drag_origin->_oxb = int32_t(_drag._drag_begin.x + off.x / canvas.zoom);
-                    _drag._drag_origin->_oyb = int32_t(_drag._drag_begin.y + off.y / canvas.zoom);
+                    _drag._drag_origin->_oxb = int32_t(pos.x);
+                    _drag._drag_origin->_oyb = int32_t(pos.y);
                     ImGui::Text("%d x %d", _drag._drag_origin->_oxb, _drag._drag_origin->_oyb);
                 }
                 ImGui::EndTooltip();
@@ -820,34 +1153,64 @@ namespace box
 
         msg::Var items    = doc.get_item("items");
         msg::Var composites = doc.get_item("composites");
-        msg::Var texture  = doc.get_item("texture");
+        msg::Var textures = doc.get_item("textures");
         msg::Var metadata = doc.get_item("metadata");
 
-        _trimed_width = 0;
-        _trimed_height = 0;
+        // Files written before multi page support carry a single texture.
+        if (!textures.is_array())
+        {
+            textures = msg::Var();
+            textures.push_back(doc.get_item("texture"));
+        }
+
         _width     = metadata.get_item("width").get(_width);
         _height    = metadata.get_item("height").get(_height);
         _padding   = metadata.get_item("padding").get(_padding);
         _spacing   = metadata.get_item("spacing").get(_spacing);
+        _block_align = metadata.get_item("block_align").get(_block_align);
+        _mip_levels  = std::clamp(metadata.get_item("mip_levels").get(_mip_levels), 0, 8);
         _trim      = metadata.get_item("trim_alpha").get(_trim);
-        _heuristic = metadata.get_item("heuristics").get(_heuristic);
-
-        Image img{};
-        _embed = texture.get_item("data").is_string();
-        if (_embed)
+        _allow_rotation = metadata.get_item("rotation").get(_allow_rotation);
+        _heuristic = std::clamp(metadata.get_item("heuristics").get(_heuristic), 0, pack_heuristic_count - 1);
+        _pack_options = metadata.get_item("pack_options").get(_pack_options);
+        _auto_size = metadata.get_item("auto_size").get(_auto_size);
+        _stable_layout = metadata.get_item("stable_layout").get(_stable_layout);
+        _share_duplicates = metadata.get_item("share_duplicates").get(_share_duplicates);
+        _online_packing = metadata.get_item("online_packing").get(_online_packing);
+        _online_order   = std::clamp(metadata.get_item("online_order").get(_online_order), 0, pack_order::OrderCount - 1);
+        _size_limits._max_size      = metadata.get_item("max_size").get(_size_limits._max_size);
+        _size_limits._power_of_two  = metadata.get_item("power_of_two").get(_size_limits._power_of_two);
+        _size_limits._square        = metadata.get_item("square").get(_size_limits._square);
+        _size_limits._multiple_of_4 = metadata.get_item("multiple_of_4").get(_size_limits._multiple_of_4);
+
+        std::vector<Image> images;
+        for (auto& texture : textures.elements())
         {
-            img = load_cb64(texture);
-        }
-        else
-        {
-            std::string txtpath = GetDirectoryPath(path);
-            txtpath.append("/").append(texture.get_item("file").str());
-            img = LoadImage(txtpath.c_str());
-        }
+            Image img{};
+            _embed = texture.get_item("data").is_string();
+            if (_embed)
+            {
+                img = load_cb64(texture);
+            }
+            else
+            {
+                std::string txtpath = GetDirectoryPath(path);
+                txtpath.append("/").append(texture.get_item("file").str());
+                img = LoadImage(txtpath.c_str());
+            }
 
-        if (!img.data)
-            return false;
+            if (!img.data)
+            {
+                for (auto& el : images)
+                {
+                    UnloadImage(el);
+                }
+                return false;
+            }
+            images.emplace_back(img);
+        }
 
+        std::vector<std::pair<sprite*, std::string>> aliases;
         for (auto& el : items.elements())
         {
             auto& itm          = _items[el.get_item("id").c_str()];
@@ -860,23 +1223,58 @@ namespace box
             itm._oya           = el.get_item("oya").get(0);
             itm._oxb           = el.get_item("oxb").get(0);
             itm._oyb           = el.get_item("oyb").get(0);
+            itm._page          = el.get_item("p").get(0);
+            itm._rotated       = el.get_item("r").get(0) != 0;
+            itm._pinned        = el.get_item("pin").get(0) != 0;
+            itm._pin_x         = el.get_item("pinx").get(0);
+            itm._pin_y         = el.get_item("piny").get(0);
+            itm._pin_page      = el.get_item("pinp").get(0);
             auto dta           = el.get_item("img");
+            auto alias         = el.get_item("alias");
+            // A duplicate takes the pixels and place of the sprite it is an
+            // alias of, once all sprites are in.
+            if (alias.is_string())
+            {
+                aliases.emplace_back(&itm, alias.str());
+                continue;
+            }
+            // Pixels are only written out for sprites that did not make it
+            // onto a page, they have no place there.
             if (dta.is_object())
             {
-                itm._img = load_cb64(dta);
+                itm._img    = load_cb64(dta);
+                itm._packed = false;
             }
-            else
+            else if (itm._page >= 0 && itm._page < (int32_t)images.size())
             {
-                itm._img = ImageFromImage(img, itm._region);
-                if (_trimed_width < itm._region.x + itm._region.width + _padding)
+                itm._img    = ImageFromImage(images[itm._page], itm.get_atlas_rect());
+                itm._packed = true;
+                if (itm._rotated)
                 {
-                    _trimed_width = int32_t(itm._region.x + itm._region.width) + _padding;
-                }
-                if (_trimed_height < itm._region.y + itm._region.height + _padding)
-                {
-                    _trimed_height = int32_t(itm._region.y + itm._region.height) + _padding;
+                    ImageRotateCCW(&itm._img);
                 }
             }
+            itm._hash = pixel_hash(itm._img);
+        }
+
+        for (auto& [itm, name] : aliases)
+        {
+            auto it = _items.find(name);
+            if (it == _items.end() || !it->second._img.data)
+                continue;
+            const auto& owner = it->second;
+            itm->_img         = ImageCopy(owner._img);
+            itm->_hash        = owner._hash;
+            itm->_packed      = owner._packed;
+            itm->_page        = owner._page;
+            itm->_rotated     = owner._rotated;
+            itm->_region.x    = owner._region.x;
+            itm->_region.y    = owner._region.y;
+        }
+
+        for (auto& el : images)
+        {
+            UnloadImage(el);
         }
 
         for (auto& el : composites.elements())
@@ -896,8 +1294,13 @@ namespace box
             }
         }
 
-        _trimed_width += _spacing;
-        _trimed_height += _spacing;
+        // A stable layout picks up where the file left off. The first pack
+        // is a final one, with the settings the file was saved with, so it
+        // finds the saved layout in the cache instead of packing online.
+        _full_repack  = !_stable_layout;
+        _final_repack = true;
+
+        update_pages();
         _reset_atlas_canvas = _reset_comp_canvas = true;
         add_to_history(path);
         return true;
@@ -905,42 +1308,96 @@ namespace box
 
     bool app::save_atlas(const char* path)
     {
+        // Pages are cut from the layout, which has to match the sprites.
+        finish_repack(true);
+
         msg::Var doc;
         msg::Var sprites;
         msg::Var composites;
         msg::Var metadata;
-        msg::Var texture;
+        msg::Var textures;
 
         metadata.set_item("width", _width);
         metadata.set_item("height", _height);
         metadata.set_item("padding", _padding);
         metadata.set_item("spacing", _spacing);
+        metadata.set_item("block_align", _block_align);
+        metadata.set_item("mip_levels", _mip_levels);
         metadata.set_item("trim_alpha", _trim);
+        metadata.set_item("rotation", _allow_rotation);
         metadata.set_item("heuristics", _heuristic);
-
-        Image image{};
-        if (_trim)
-            image = GenImageColor(_trimed_width, _trimed_height, {});
-        else
-            image = GenImageColor(_width, _height, {});
+        metadata.set_item("pack_options", _pack_options);
+        metadata.set_item("auto_size", _auto_size);
+        metadata.set_item("stable_layout", _stable_layout);
+        metadata.set_item("online_packing", _online_packing);
+        metadata.set_item("share_duplicates", _share_duplicates);
+        metadata.set_item("online_order", _online_order);
+        metadata.set_item("max_size", _size_limits._max_size);
+        metadata.set_item("power_of_two", _size_limits._power_of_two);
+        metadata.set_item("square", _size_limits._square);
+        metadata.set_item("multiple_of_4", _size_limits._multiple_of_4);
+
+        std::vector<Image> images;
+        for (auto& page : _pages)
+        {
+            if (_trim)
+                images.emplace_back(GenImageColor(page._trimed_width, page._trimed_height, {}));
+            else
+                images.emplace_back(GenImageColor(_width, _height, {}));
+        }
 
         for (auto& itm : _items)
         {
             msg::Var spr;
             spr.set_item("id", std::string_view(itm.first));
             sprites.push_back(spr);
+            // A duplicate shows the region of the sprite it is an alias of,
+            // which draws the pixels.
+            const auto* owner = find_alias_owner(&itm.second);
+            if (owner)
+            {
+                spr.set_item("alias", get_sprite_id(owner));
+            }
             if (itm.second._packed)
             {
                 spr.set_item("x", itm.second._region.x);
                 spr.set_item("y", itm.second._region.y);
-                ImageDraw(&image,
-                          itm.second._img,
-                          {0, 0, itm.second._region.width, itm.second._region.height},
-                          itm.second._region,
-                          WHITE);
+                if (itm.second._page)
+                {
+                    spr.set_item("p", itm.second._page);
+                }
+                if (itm.second._rotated)
+                {
+                    spr.set_item("r", 1);
+                }
+                if (owner)
+                {
+                    // drawn by the owner
+                }
+                else if (itm.second._rotated)
+                {
+                    Image rotated = ImageCopy(itm.second._img);
+                    ImageRotateCW(&rotated);
+                    ImageDraw(&images[itm.second._page],
+                              rotated,
+                              {0, 0, (float)rotated.width, (float)rotated.height},
+                              itm.second.get_atlas_rect(),
+                              WHITE);
+                    UnloadImage(rotated);
+                }
+                else
+                {
+                    ImageDraw(&images[itm.second._page],
+                              itm.second._img,
+                              {0, 0, itm.second._region.width, itm.second._region.height},
+                              itm.second._region,
+                              WHITE);
+                }
             }
-            else
+            else if (!owner)
             {
+                // Only sprites larger than a page end up here. Their
+                // duplicates share the pixels written for the owner.
                 spr.set_item("img", save_cb64(itm.second._img));
             }
 
@@ -966,6 +1423,13 @@ namespace box
             {
                 spr.set_item("oyb", itm.second._oyb);
             }
+            if (itm.second._pinned)
+            {
+                spr.set_item("pin", 1);
+                spr.set_item("pinx", itm.second._pin_x);
+                spr.set_item("piny", itm.second._pin_y);
+                spr.set_item("pinp", itm.second._pin_page);
+            }
         }
 
         for (auto& itm : _compositions)
@@ -991,28 +1455,37 @@ namespace box
             cmp.set_item("items", nodes);
         }
 
-        auto r = false;
+        auto r = true;
 
-        if (_embed)
+        for (size_t n = 0; n < images.size(); ++n)
         {
-            texture = save_cb64(image);
-        }
-        else
-        {
-            std::string texturename(GetFileNameWithoutExt(path));
-            texturename.append(".png");
-            std::string txtpath = GetDirectoryPath(path);
-            txtpath.append("/").append(texturename);
-            r = ExportImage(image, txtpath.c_str());
-            texture.set_item("file", std::string_view(texturename));
-            texture.set_item("width", image.width);
-            texture.set_item("height", image.height);
+            auto&    image = images[n];
+            msg::Var texture;
+            if (_embed)
+            {
+                texture = save_cb64(image);
+            }
+            else
+            {
+                std::string texturename(GetFileNameWithoutExt(path));
+                if (n)
+                    texturename.append("_").append(std::to_string(n));
+                texturename.append(".png");
+                std::string txtpath = GetDirectoryPath(path);
+                txtpath.append("/").append(texturename);
+                r = ExportImage(image, txtpath.c_str()) && r;
+                texture.set_item("file", std::string_view(texturename));
+                texture.set_item("width", image.width);
+                texture.set_item("height", image.height);
+            }
+            textures.push_back(texture);
+            UnloadImage(image);
         }
 
         doc.set_item("items", sprites);
         doc.set_item("composites", composites);
         doc.set_item("metadata", metadata);
-        doc.set_item("texture", texture);
+        doc.set_item("textures", textures);
 
         std::string txt;
         doc.to_string(txt);
@@ -1046,15 +1519,49 @@ namespace box
         auto* name = GetFileNameWithoutExt(path);
         auto  it   = _items.find(name);
 
+        sprite prev;
         if (it != _items.end())
         {
+            prev = it->second;
             UnloadImage(it->second._img);
             UnloadTexture(it->second._txt);
             _items.erase(name);
         }
 
-        auto& spr = _items[name];
-        spr._img  = img;
+        auto& spr     = _items[name];
+        spr._img      = img;
+        spr._hash     = pixel_hash(img);
+        spr._pinned   = prev._pinned;
+        spr._pin_x    = prev._pin_x;
+        spr._pin_y    = prev._pin_y;
+        spr._pin_page = prev._pin_page;
+
+        // A new image of the same size keeps its place, the packer never
+        // hears about it. Unless it was or becomes a duplicate, that changes
+        // which sprites get a region of their own.
+        const auto shared = [&]()
+        {
+            return prev._alias || std::any_of(_items.begin(),
+                                               _items.end(),
+                                               [&](const auto& el)
+                                               {
+                                                   return &el.second != &spr &&
+                                                          (el.second._alias == prev._id || el.second._hash == spr._hash);
+                                               });
+        };
+        _changes |= app_change::Pixels;
+        if (prev._id && prev._img.width == img.width && prev._img.height == img.height && !shared())
+        {
+            spr._id      = prev._id;
+            spr._region  = prev._region;
+            spr._page    = prev._page;
+            spr._packed  = prev._packed;
+            spr._rotated = prev._rotated;
+        }
+        else
+        {
+            _changes |= app_change::Layout;
+        }
 
         return true;
     }
@@ -1127,6 +1634,7 @@ namespace box
                 if (spr == _active)
                     _active = nullptr;
                 _items.erase(el.first);
+                _changes |= app_change::Layout;
                 return true;
             }
         }
@@ -1149,64 +1657,364 @@ namespace box
         return _items.end() == it ? nullptr : &it->second;
     }
 
-    bool app::repack()
+    const sprite* app::find_alias_owner(const sprite* spr) const
     {
-        _item_rect.clear();
-        _item_pos.clear();
-        _sprites.clear();
+        if (!spr || !spr->_alias)
+            return nullptr;
+        for (auto& el : _items)
+        {
+            if (el.second._id == spr->_alias)
+                return &el.second;
+        }
+        return nullptr;
+    }
+
+    void app::find_duplicates()
+    {
+        // The first sprite of a set of equal images is packed, the others
+        // show its region. Pinned sprites keep a spot of their own.
+        std::unordered_map<uint64_t, std::vector<const sprite*>> owners;
+        _aliases = 0;
+        for (auto& el : _items)
+        {
+            auto& spr = el.second;
+            if (!spr._id)
+                spr._id = ++_next_id;
+            spr._alias = 0;
+            if (!_share_duplicates || spr._pinned)
+                continue;
+
+            auto& same = owners[spr._hash];
+            auto  it   = std::find_if(
+                same.begin(), same.end(), [&](const sprite* own) { return same_pixels(own->_img, spr._img); });
+            if (it == same.end())
+            {
+                same.emplace_back(&spr);
+                continue;
+            }
+            spr._alias = (*it)->_id;
+            ++_aliases;
+        }
+    }
 
+    void app::repack(bool final)
+    {
+        // The worker packs a snapshot of the sprites; the current layout
+        // stays on screen until apply_layout() swaps in the new one.
+        pack_request request;
+        request._settings._size_limits    = _size_limits;
+        request._settings._width          = _width;
+        request._settings._height         = _height;
+        request._settings._padding        = _padding;
+        request._settings._spacing        = get_spacing();
+        request._settings._alignment      = get_alignment();
+        request._settings._heuristic      = _heuristic;
+        request._settings._options        = _pack_options;
+        // While editing, maxRects places sprites one by one, largest first;
+        // a final build picks the best sprite at every step.
+        if (_online_packing && !final && _heuristic < pack_heuristic_auto)
+        {
+            request._settings._options |= pack_maxrects_online;
+            request._settings._order    = _online_order;
+        }
+        request._settings._allow_rotation = _allow_rotation;
+        request._settings._auto_size      = _auto_size;
+        request._repack_threshold         = _repack_threshold;
+        request._full                     = _full_repack;
+        request._stable                   = _stable_layout;
+        if (!_path.empty())
+            request._cache_path = _path + ".cache";
+        _full_repack                      = false;
+        _final_repack                     = false;
+
+        find_duplicates();
         for (auto& el : _items)
         {
-            _sprites.emplace_back(&el.second);
-            auto& rc  = _item_rect.emplace_back();
-            auto& pos = _item_pos.emplace_back();
+            if (el.second._alias)
+                continue;
+
+            auto& rc  = request._rects.emplace_back();
             rc.width  = el.second._img.width + _padding * 2;
             rc.height = el.second._img.height + _padding * 2;
+            request._ids.emplace_back(el.second._id);
+
+            if (el.second._pinned)
+            {
+                auto& pin   = request._settings._pins.emplace_back();
+                pin._id     = el.second._id;
+                pin._left   = el.second._pin_x - _padding - request._settings._spacing;
+                pin._top    = el.second._pin_y - _padding - request._settings._spacing;
+                pin._width  = rc.width;
+                pin._height = rc.height;
+                pin._page   = el.second._pin_page;
+            }
+
+            // Where the sprite is now, for the worker to rebuild the layout
+            // from when it has none.
+            if (_stable_layout)
+            {
+                auto& pos = request._previous.emplace_back();
+                if (el.second._packed)
+                {
+                    pos.left    = (int32_t)el.second._region.x - _padding - request._settings._spacing;
+                    pos.top     = (int32_t)el.second._region.y - _padding - request._settings._spacing;
+                    pos.rotated = el.second._rotated;
+                    pos.used    = 1;
+                }
+                request._previous_pages.emplace_back(el.second._page);
+            }
+        }
+        _worker.post(std::move(request));
+    }
+
+    void app::apply_layout()
+    {
+        std::unordered_map<int32_t, sprite*> sprites;
+        for (auto& el : _items)
+        {
+            sprites[el.second._id] = &el.second;
         }
 
-        float occupancy = 0;
-        auto  ret       = maxRects(_width - _spacing * 2,
-                            _height - _spacing * 2,
-                            (int32_t)_item_rect.size(),
-                            _item_rect.data(),
-                            maxRectsFreeRectChoiceHeuristic(_heuristic),
-                            0,
-                            _item_pos.data(),
-                            &occupancy);
+        const auto& settings = _layout._settings;
+        if (settings._auto_size)
+        {
+            _width  = _layout._width;
+            _height = _layout._height;
+        }
 
-        _trimed_width  = 0;
-        _trimed_height = 0;
+        // Sprites removed since the snapshot are skipped, the ones added since
+        // wait for the next layout. Packed sprites that end up anywhere else
+        // count as moved.
+        _moved = 0;
+        for (size_t n = 0; n < _layout._ids.size(); ++n)
+        {
+            auto it = sprites.find(_layout._ids[n]);
+            if (it == sprites.end())
+                continue;
+
+            auto*       spr = it->second;
+            const auto& pos = _layout._positions[n];
+            const auto  x   = (float)pos.left + settings._padding + settings._spacing;
+            const auto  y   = (float)pos.top + settings._padding + settings._spacing;
+            if (spr->_packed && (!pos.used || spr->_page != _layout._pages[n] || spr->_rotated != (pos.rotated != 0) ||
+                                 spr->_region.x != x || spr->_region.y != y))
+                ++_moved;
+
+            spr->_packed         = pos.used;
+            spr->_page           = _layout._pages[n];
+            spr->_rotated        = pos.rotated;
+            spr->_region.x       = x;
+            spr->_region.y       = y;
+            spr->_region.width   = (float)spr->_img.width;
+            spr->_region.height  = (float)spr->_img.height;
+        }
 
-        for (int32_t n = 0; n < (int32_t)_item_rect.size(); ++n)
+        for (auto& el : _items)
         {
-            _sprites[n]->_packed        = _item_pos[n].used;
-            _sprites[n]->_region.x      = (float)_item_pos[n].left + _padding + _spacing;
-            _sprites[n]->_region.y      = (float)_item_pos[n].top + _padding + _spacing;
-            _sprites[n]->_region.width  = (float)_sprites[n]->_img.width;
-            _sprites[n]->_region.height = (float)_sprites[n]->_img.height;
-            if (!_sprites[n]->_txt.id)
+            auto* spr = &el.second;
+            auto  it  = sprites.find(spr->_alias);
+            if (!spr->_alias || it == sprites.end())
+                continue;
+            spr->_packed        = it->second->_packed;
+            spr->_page          = it->second->_page;
+            spr->_rotated       = it->second->_rotated;
+            spr->_region.x      = it->second->_region.x;
+            spr->_region.y      = it->second->_region.y;
+            spr->_region.width  = (float)spr->_img.width;
+            spr->_region.height = (float)spr->_img.height;
+        }
+        update_pages();
+    }
+
+    void app::apply_changes()
+    {
+        if (_changes & app_change::Pixels)
+        {
+            for (auto& el : _items)
             {
-                _sprites[n]->_txt = LoadTextureFromImage(_sprites[n]->_img);
-              
-                //  SetTextureFilter(_sprites[n]->_txt, RL_TEXTURE_FILTER_BILINEAR);
+                if (!el.second._txt.id)
+                    el.second._txt = LoadTextureFromImage(el.second._img);
             }
-            if (_sprites[n]->_packed)
+        }
+        if (_changes & app_change::Layout)
+            repack(_final_repack);
+        _changes = 0;
+    }
+
+    void app::finish_repack(bool final)
+    {
+        apply_changes();
+        _worker.wait();
+        if (_worker.fetch(_layout))
+            apply_layout();
+
+        // A stable layout keeps the places it has, anything else is packed
+        // again the slow way before it is written out.
+        if (final && !_stable_layout && (_layout._settings._options & pack_maxrects_online))
+        {
+            _full_repack = true;
+            repack(true);
+            _worker.wait();
+            if (_worker.fetch(_layout))
+                apply_layout();
+        }
+    }
+
+    void app::update_pages()
+    {
+        _pages.clear();
+
+        for (auto& el : _items)
+        {
+            auto& spr = el.second;
+            if (!spr._packed)
+                continue;
+
+            if ((int32_t)_pages.size() <= spr._page)
+                _pages.resize(spr._page + 1);
+
+            auto&      page = _pages[spr._page];
+            const auto rect = spr.get_atlas_rect();
+            if (page._trimed_width < rect.x + rect.width + _padding)
             {
-                if (_trimed_width < _sprites[n]->_region.x + _sprites[n]->_region.width + _padding)
-                {
-                    _trimed_width = int32_t(_sprites[n]->_region.x + _sprites[n]->_region.width + _padding);
-                }
+                page._trimed_width = int32_t(rect.x + rect.width + _padding);
+            }
 
-                if (_trimed_height < _sprites[n]->_region.y + _sprites[n]->_region.height + _padding)
-                {
-                    _trimed_height = int32_t(_sprites[n]->_region.y + _sprites[n]->_region.height + _padding);
-                }
+            if (page._trimed_height < rect.y + rect.height + _padding)
+            {
+                page._trimed_height = int32_t(rect.y + rect.height + _padding);
             }
         }
-        _trimed_width += _spacing;
-        _trimed_height += _spacing;
 
-        return ret != -1;
+        if (_pages.empty())
+            _pages.emplace_back();
+
+        for (auto& page : _pages)
+        {
+            page._trimed_width += get_spacing();
+            page._trimed_height += get_spacing();
+        }
+        _page = std::min(_page, (int32_t)_pages.size() - 1);
+    }
+
+    void app::benchmark()
+    {
+        // Packs the current sprites once with every engine, from scratch and
+        // with the current atlas settings.
+        std::vector<maxRectsSize>     rects;
+        std::vector<int32_t>          ids;
+        std::vector<maxRectsPosition> results(_items.size());
+        std::vector<int32_t>          pages(_items.size());
+        for (auto& el : _items)
+        {
+            auto& rc  = rects.emplace_back();
+            rc.width  = el.second._img.width + _padding * 2;
+            rc.height = el.second._img.height + _padding * 2;
+            ids.emplace_back((int32_t)ids.size() + 1);
+        }
+
+        _benchmark.clear();
+        packer     pck;
+        const auto spacing = get_spacing();
+        pck.set_alignment(get_alignment());
+        for (int32_t heuristic = 0; heuristic < pack_heuristic_count; ++heuristic)
+        {
+            if (heuristic == pack_heuristic_auto)
+                continue;
+
+            pck.reset(_width - spacing * 2, _height - spacing * 2, heuristic, pack_order::Input, _allow_rotation, _pack_options);
+            const auto start = std::chrono::steady_clock::now();
+            pck.insert(rects.size(), rects.data(), ids.data(), results.data(), pages.data());
+            const auto stop = std::chrono::steady_clock::now();
+
+            auto& res         = _benchmark.emplace_back();
+            res._heuristic    = heuristic;
+            res._milliseconds = std::chrono::duration<double, std::milli>(stop - start).count();
+            res._pages        = pck.page_count();
+            res._occupancy    = pck.occupancy();
+        }
+    }
+
+    bool app::save_sizes(const char* path) const
+    {
+        // One "width height" line per sprite, padding included, for the
+        // packing benchmark in bench/.
+        std::string txt = "# width height\n";
+        for (auto& el : _items)
+        {
+            txt += std::to_string(el.second._img.width + _padding * 2);
+            txt += ' ';
+            txt += std::to_string(el.second._img.height + _padding * 2);
+            txt += '\n';
+        }
+        return SaveFileText(path, txt.data());
+    }
+
+    bool app::check_round_trip() const
+    {
+        // A scratch atlas with a sprite larger than its page, which stays
+        // unpacked, and duplicates of a packed and that unpacked sprite is
+        // saved and opened again. Every sprite has to come back
+        // with its pixels, packed ones at their place and the others unpacked,
+        // and the pages with the same size.
+        properties_t props;
+        app          saved(props);
+        saved._width  = 64;
+        saved._height = 64;
+        saved._embed  = true;
+        for (auto [name, width, height, color] : {std::tuple{"red", 16, 16, RED},
+                                                  std::tuple{"green", 8, 24, GREEN},
+                                                  std::tuple{"green copy", 8, 24, GREEN},
+                                                  std::tuple{"oversize", 80, 40, BLUE},
+                                                  std::tuple{"oversize copy", 80, 40, BLUE}})
+        {
+            saved._items[name]._img = GenImageColor(width, height, color);
+        }
+        saved._changes = app_change::Layout | app_change::Pixels;
+
+        const auto path = (std::filesystem::temp_directory_path() / "texturepack_round_trip.json").string();
+        app        loaded(props);
+        auto       ok = saved.save_atlas(path.c_str()) && loaded.open_atlas(path.c_str()) &&
+                  !saved._items["oversize"]._packed && loaded._items.size() == saved._items.size() &&
+                  loaded._pages.size() == saved._pages.size();
+        for (auto& el : saved._items)
+        {
+            auto it = loaded._items.find(el.first);
+            if (!ok || it == loaded._items.end())
+            {
+                ok = false;
+                break;
+            }
+            const auto& a = el.second;
+            const auto& b = it->second;
+            ok = a._packed == b._packed && same_pixels(a._img, b._img) &&
+                 (!a._packed || (a._page == b._page && a._rotated == b._rotated && a._region.x == b._region.x &&
+                                 a._region.y == b._region.y));
+        }
+        for (size_t n = 0; ok && n < saved._pages.size(); ++n)
+        {
+            ok = saved._pages[n]._trimed_width == loaded._pages[n]._trimed_width &&
+                 saved._pages[n]._trimed_height == loaded._pages[n]._trimed_height;
+        }
+
+        // The unpacked sprite and its duplicate share one copy of the pixels.
+        if (auto* txt = ok ? LoadFileText(path.c_str()) : nullptr)
+        {
+            std::string_view doc(txt);
+            size_t           copies = 0;
+            for (auto at = doc.find("\"img\""); at != doc.npos; at = doc.find("\"img\"", at + 1))
+            {
+                ++copies;
+            }
+            ok = copies == 1;
+            UnloadFileText(txt);
+        }
+
+        saved.reset();
+        loaded.reset();
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return ok;
     }
 
     void app::reset()
@@ -1220,21 +2028,51 @@ namespace box
         _compositions.clear();
         _path.clear();
         _active             = nullptr;
+        _page               = {};
+        _pages.clear();
         _atlas_canvas.zoom  = {1.f};
         _comp_canvas.zoom   = {1.f};
         _heuristic          = {};
+        _pack_options       = pack_guillotine_merge | pack_grid_runs;
         _padding            = {};
+        _block_align        = {1};
+        _mip_levels         = {};
         _width              = {512};
         _height             = {512};
         _trim               = {};
+        _allow_rotation     = {};
+        _auto_size          = {};
+        _stable_layout      = {};
+        _online_packing     = true;
+        _share_duplicates   = true;
+        _aliases            = {};
+        _online_order       = pack_order::Area;
+        _moved              = {};
+        _size_limits        = {};
         _composite_mode     = false;
-        _dirty              = true;
+        _changes            = app_change::Layout | app_change::Pixels;
+        _full_repack        = true;
+        _final_repack       = false;
         _reset_atlas_canvas = _reset_comp_canvas = true;
     }
 
     ImVec2 app::get_texture_size() const
     {
-        return ImVec2(!_trim ? (float)_width : (float)_trimed_width, !_trim ? (float)_height : (float)_trimed_height);
+        if (_trim && _page < (int32_t)_pages.size())
+            return ImVec2((float)_pages[_page]._trimed_width, (float)_pages[_page]._trimed_height);
+        return ImVec2((float)_width, (float)_height);
+    }
+
+    int32_t app::get_alignment() const
+    {
+        return std::max(_block_align, 1 << _mip_levels);
+    }
+
+    int32_t app::get_spacing() const
+    {
+        // Rounded up so rects aligned inside the border stay aligned on the page.
+        const auto alignment = get_alignment();
+        return (_spacing + alignment - 1) / alignment * alignment;
     }
 
     Image app::load_cb64(msg::Var ar) const
@@ -1273,6 +2111,26 @@ namespace box
         return out;
     }
 
+    Rectangle sprite::get_atlas_rect() const
+    {
+        if (_rotated)
+            return {_region.x, _region.y, _region.height, _region.width};
+        return _region;
+    }
+
+    point2f sprite::to_atlas(point2f local) const
+    {
+        if (_rotated)
+            return {_region.x + _region.height - local.y, _region.y + local.x};
+        return {_region.x + local.x, _region.y + local.y};
+    }
+
+    point2f sprite::to_local(point2f atlas) const
+    {
+        if (_rotated)
+            return {atlas.y - _region.y, _region.x + _region.height - atlas.x};
+        return {atlas.x - _region.x, atlas.y - _region.y};
+    }
 
     bool composition::draw(size_t nde, ImDrawList* dc, matrix2d& tr)
     {
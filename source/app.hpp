@@ -1,6 +1,7 @@
 #pragma once
 
 #include "include.hpp"
+#include "pack_worker.hpp"
 
 namespace box
 {
@@ -17,17 +18,55 @@ namespace box
         NinePatch,
     };
 
+    // What an edit touched. Only the stages that depend on it run, anything
+    // else (origins, compositions, export options) costs no rebuild at all.
+    enum app_change : int32_t
+    {
+        Layout = 1 << 0, // rect sizes, pins or packing settings: repack
+        Pixels = 1 << 1, // sprite images: texture upload
+    };
+
 	struct sprite
 	{
+        // _region holds the atlas position and the upright sprite size. A
+        // rotated sprite is stored turned 90 degrees clockwise, so its atlas
+        // footprint has width and height swapped.
+        Rectangle get_atlas_rect() const;
+        point2f   to_atlas(point2f local) const;
+        point2f   to_local(point2f atlas) const;
+
         Image     _img{};
         Texture   _txt{};
+        uint64_t  _hash{}; // of the pixels, equal images share one region
         Rectangle _region{};
         int32_t   _oxa{};
         int32_t   _oya{};
         int32_t   _oxb{};
         int32_t   _oyb{};
         int32_t   _data{sprite_data::Defualt};
+        int32_t   _id{};
+        int32_t   _page{};
+        int32_t   _pin_x{}; // atlas position kept by a pinned sprite
+        int32_t   _pin_y{};
+        int32_t   _pin_page{};
+        int32_t   _alias{}; // id of the sprite whose region this one shows, 0 for none
         bool      _packed{};
+        bool      _rotated{};
+        bool      _pinned{};
+    };
+
+    struct atlas_page
+    {
+        int32_t _trimed_width{};
+        int32_t _trimed_height{};
+    };
+
+    struct benchmark_result
+    {
+        int32_t _heuristic{};
+        double  _milliseconds{};
+        size_t  _pages{};
+        float   _occupancy{};
     };
 
     struct composition
@@ -100,6 +139,7 @@ namespace box
         void show_composite_properties();
         void show_node_properties();
         void show_sprite_properties();
+        void show_benchmark();
         void show_list();
         void show_composition();
         void show_texture();
@@ -116,9 +156,20 @@ namespace box
         bool remove_file(sprite* spr);
         std::string_view get_sprite_id(const sprite* spr) const;
         const sprite* get_sprite(std::string_view spr) const;
-        bool repack();
+        const sprite* find_alias_owner(const sprite* spr) const;
+        void find_duplicates();
+        void repack(bool final = false);
+        void apply_layout();
+        void apply_changes();
+        void finish_repack(bool final = false);
+        void benchmark();
+        bool save_sizes(const char* path) const;
+        bool check_round_trip() const;
+        void update_pages();
         void reset();
         ImVec2 get_texture_size() const;
+        int32_t get_alignment() const;
+        int32_t get_spacing() const;
 
         Image    load_cb64(msg::Var ar) const;
         msg::Var save_cb64(Image img) const;
@@ -131,28 +182,45 @@ namespace box
         drag_data                          _drag{};
         std::string                        _active_name;
         std::string                        _active_comp_name;
-        std::vector<sprite*>               _sprites;
         int32_t                            _heuristic{};
+        int32_t                            _pack_options{pack_guillotine_merge | pack_grid_runs};
         int32_t                            _padding{};
         int32_t                            _spacing{};
+        int32_t                            _block_align{1};
+        int32_t                            _mip_levels{};
+        int32_t                            _online_order{pack_order::Area};
         int32_t                            _width{512};
         int32_t                            _height{512};
-        int32_t                            _trimed_width{512};
-        int32_t                            _trimed_height{512};
+        pack_size_limits                   _size_limits;
+        std::vector<atlas_page>            _pages;
+        int32_t                            _page{};
+        int32_t                            _next_id{};
+        int32_t                            _moved{};
+        int32_t                            _aliases{};
+        int32_t                            _changes{}; // app_change flags
+        float                              _repack_threshold{0.75f};
         bool                               _trim{};
+        bool                               _allow_rotation{};
+        bool                               _auto_size{};
+        bool                               _stable_layout{};
+        bool                               _online_packing{true}; // maxRects places one by one while editing
+        bool                               _share_duplicates{true};
         bool                               _embed{};
         bool                               _drop_node{};
         bool                               _visible_origin{};
         bool                               _visible_region{true};
         bool                               _visible_index{};
         bool                               _composite_mode{};
-        bool                               _dirty{};
+        bool                               _full_repack{true};
+        bool                               _final_repack{}; // next pack as a final build, the way files are saved
         bool                               _reset_atlas_canvas{true};
         bool                               _reset_comp_canvas{true};
+        bool                               _show_benchmark{};
         std::string                        _path;
         std::string                        _str;
-        std::vector<maxRectsSize>          _item_rect;
-        std::vector<maxRectsPosition>      _item_pos;
+        std::vector<benchmark_result>      _benchmark;
+        pack_layout                        _layout;
+        pack_worker                        _worker;
         point2f                            _mouse{NAN, NAN};
         Texture                            _alpha_txt{};
         ImGui::CanvasParams                _atlas_canvas{};
@@ -19,6 +19,7 @@
 #include <queue>
 #include <functional>
 #include <chrono>
+#include <filesystem>
 
 #include <imgui.h>
 #include <imgui_internal.h>
@@ -32,6 +33,9 @@ extern "C"
 #endif
 
 #include "maxrects.h"
+#include "skyline.h"
+#include "guillotine.h"
+#include "shelf.h"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,122 @@
+#include "layout_cache.hpp"
+
+namespace box
+{
+    // Bump when a packer change moves rects, so older files stop matching.
+    static constexpr int32_t layout_cache_version = 1;
+    static constexpr size_t  layout_cache_entries = 16;
+
+    uint64_t layout_cache::hash(uint64_t seed, int64_t value)
+    {
+        for (int32_t n = 0; n < 8; ++n)
+        {
+            seed ^= uint64_t(value >> (n * 8)) & 0xff;
+            seed *= 0x100000001b3ull;
+        }
+        return seed;
+    }
+
+    const layout_cache::entry* layout_cache::find(uint64_t key, size_t count) const
+    {
+        for (auto it = _entries.rbegin(); it != _entries.rend(); ++it)
+        {
+            if (it->_key == key && it->_positions.size() == count)
+                return &*it;
+        }
+        return nullptr;
+    }
+
+    void layout_cache::store(entry&& ent)
+    {
+        std::erase_if(_entries, [&](const entry& el) { return el._key == ent._key; });
+        if (_entries.size() >= layout_cache_entries)
+            _entries.erase(_entries.begin());
+        _entries.emplace_back(std::move(ent));
+    }
+
+    bool layout_cache::load(const char* path)
+    {
+        auto v = LoadFileText(path);
+        if (!v)
+            return false;
+
+        msg::Var doc;
+        if (msg::VarError::ok != doc.from_string(v))
+        {
+            UnloadFileText(v);
+            return false;
+        }
+        UnloadFileText(v);
+
+        if (doc.get_item("version").get(0) != layout_cache_version)
+            return false;
+
+        std::vector<entry> loaded;
+        for (auto& el : doc.get_item("layouts").elements())
+        {
+            auto& ent      = loaded.emplace_back();
+            ent._key       = std::strtoull(std::string(el.get_item("key").str()).c_str(), nullptr, 16);
+            ent._width     = el.get_item("width").get(0);
+            ent._height    = el.get_item("height").get(0);
+            ent._heuristic = el.get_item("heuristic").get(0);
+            ent._order     = el.get_item("order").get(0);
+
+            // Four values per rect: left, top, used | rotated << 1 and page.
+            auto rects = el.get_item("rects");
+            for (uint32_t n = 0; n + 3 < rects.size(); n += 4)
+            {
+                const auto flags = rects.get_item(n + 2).get(0);
+                auto&      pos   = ent._positions.emplace_back();
+                pos.left         = rects.get_item(n).get(0);
+                pos.top          = rects.get_item(n + 1).get(0);
+                pos.used         = (flags & 1) != 0;
+                pos.rotated      = (flags & 2) != 0;
+                ent._pages.emplace_back(rects.get_item(n + 3).get(0));
+            }
+        }
+
+        std::erase_if(loaded, [this](const entry& ent) { return find(ent._key, ent._positions.size()) != nullptr; });
+        _entries.insert(_entries.begin(), std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.end()));
+        while (_entries.size() > layout_cache_entries)
+        {
+            _entries.erase(_entries.begin());
+        }
+        return true;
+    }
+
+    bool layout_cache::save(const char* path) const
+    {
+        msg::Var doc;
+        msg::Var layouts;
+        for (auto& ent : _entries)
+        {
+            // Written on the pack worker, so no TextFormat() and its shared buffer.
+            char key[24];
+            snprintf(key, sizeof(key), "%016llx", (unsigned long long)ent._key);
+
+            msg::Var layout;
+            msg::Var rects;
+            layout.set_item("key", std::string_view(key));
+            layout.set_item("width", ent._width);
+            layout.set_item("height", ent._height);
+            layout.set_item("heuristic", ent._heuristic);
+            layout.set_item("order", ent._order);
+            for (size_t n = 0; n < ent._positions.size(); ++n)
+            {
+                const auto& pos = ent._positions[n];
+                rects.push_back(pos.left);
+                rects.push_back(pos.top);
+                rects.push_back((pos.used ? 1 : 0) | (pos.rotated ? 2 : 0));
+                rects.push_back(ent._pages[n]);
+            }
+            layout.set_item("rects", rects);
+            layouts.push_back(layout);
+        }
+        doc.set_item("version", layout_cache_version);
+        doc.set_item("layouts", layouts);
+
+        std::string txt;
+        doc.to_string(txt);
+        return SaveFileText(path, txt.data());
+    }
+} // namespace box
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "include.hpp"
+
+namespace box
+{
+    // Layouts packed from scratch, by a hash of everything that went into
+    // them: settings and rect sizes in input order. Packing is deterministic,
+    // so a hit is the layout a new pack would come up with. Holds the most
+    // recent entries in memory and can mirror them to a file.
+    class layout_cache
+    {
+    public:
+        struct entry
+        {
+            uint64_t                      _key{};
+            std::vector<maxRectsPosition> _positions;
+            std::vector<int32_t>          _pages;
+            int32_t                       _width{};
+            int32_t                       _height{};
+            int32_t                       _heuristic{};
+            int32_t                       _order{};
+        };
+
+        // Mixes values into an FNV-1a hash.
+        static uint64_t hash(uint64_t seed, int64_t value);
+
+        const entry* find(uint64_t key, size_t count) const;
+        void         store(entry&& ent);
+
+        // The file keeps the same entries as memory. load() merges them in,
+        // entries already in memory win.
+        bool load(const char* path);
+        bool save(const char* path) const;
+
+    private:
+        std::vector<entry> _entries; // oldest first
+    };
+} // namespace box
@@ -0,0 +1,387 @@
+#include "pack_worker.hpp"
+
+namespace box
+{
+    static uint64_t request_key(const pack_request& request)
+    {
+        const auto& settings = request._settings;
+        const auto& limits   = settings._size_limits;
+
+        uint64_t key = 0xcbf29ce484222325ull;
+        for (int64_t value : {int64_t(limits._max_size),
+                              int64_t(limits._power_of_two),
+                              int64_t(limits._square),
+                              int64_t(limits._multiple_of_4),
+                              int64_t(settings._width),
+                              int64_t(settings._height),
+                              int64_t(settings._padding),
+                              int64_t(settings._spacing),
+                              int64_t(settings._heuristic),
+                              int64_t(settings._options),
+                              int64_t(settings._order),
+                              int64_t(settings._alignment),
+                              int64_t(settings._allow_rotation),
+                              int64_t(settings._auto_size)})
+        {
+            key = layout_cache::hash(key, value);
+        }
+        for (const auto& rc : request._rects)
+        {
+            key = layout_cache::hash(key, (int64_t(rc.width) << 32) | uint32_t(rc.height));
+        }
+
+        // Ids change between sessions, pins are keyed by the rect they hold.
+        for (const auto& pin : settings._pins)
+        {
+            const auto index = std::find(request._ids.begin(), request._ids.end(), pin._id) - request._ids.begin();
+            for (int64_t value : {int64_t(index), int64_t(pin._left), int64_t(pin._top), int64_t(pin._page)})
+            {
+                key = layout_cache::hash(key, value);
+            }
+        }
+        return key;
+    }
+
+    pack_worker::pack_worker()
+    {
+        _packer.set_control(&_control);
+        _packer.set_pool(&_pool);
+        _thread = std::thread([this]() { run(); });
+    }
+
+    pack_worker::~pack_worker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _control.cancel();
+        }
+        _wake.notify_all();
+        _thread.join();
+    }
+
+    void pack_worker::post(pack_request&& request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // A request that never ran may have asked to start over.
+            request._full = request._full || (_has_queued && _queued._full);
+            _queued       = std::move(request);
+            _has_queued   = true;
+            if (_running)
+                _control.cancel();
+        }
+        _wake.notify_one();
+    }
+
+    bool pack_worker::fetch(pack_layout& layout)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_has_front)
+            return false;
+        std::swap(layout, _front);
+        _has_front = false;
+        return true;
+    }
+
+    void pack_worker::wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _idle.wait(lock, [this]() { return !_running && !_has_queued; });
+    }
+
+    bool pack_worker::busy() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _running || _has_queued;
+    }
+
+    float pack_worker::progress() const
+    {
+        return _control.progress();
+    }
+
+    void pack_worker::run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;)
+        {
+            _wake.wait(lock, [this]() { return _stop || _has_queued; });
+            if (_stop)
+                return;
+
+            std::swap(_current, _queued);
+            _has_queued = false;
+            _running    = true;
+            _control.restart();
+            lock.unlock();
+
+            const auto done = pack(_current, _back);
+
+            lock.lock();
+            _running = false;
+            if (done)
+            {
+                std::swap(_front, _back);
+                _has_front = true;
+            }
+            if (!_has_queued)
+                _idle.notify_all();
+        }
+    }
+
+    bool pack_worker::pack(const pack_request& request, pack_layout& layout)
+    {
+        const auto& settings = request._settings;
+
+        // Any change may move the smallest page size, so auto size always
+        // starts over. A stable layout only starts over when asked to; when
+        // the packer holds nothing to extend, it is rebuilt from the previous
+        // positions instead.
+        auto       full   = request._full || (!request._stable && (!_valid || !(settings == _settings) || settings._auto_size));
+        const auto reseed = !full && (!_valid || !(settings == _settings));
+        _settings         = settings;
+        _valid            = false;
+
+        _pinned_ids.clear();
+        for (const auto& pin : settings._pins)
+        {
+            _pinned_ids.emplace_back(pin._id);
+        }
+        std::sort(_pinned_ids.begin(), _pinned_ids.end());
+
+        if (request._cache_path != _cache_path)
+        {
+            _cache_path = request._cache_path;
+            if (!_cache_path.empty())
+                _cache.load(_cache_path.c_str());
+        }
+
+        // A layout packed from scratch for the same input is what this pack
+        // would come up with. The packer is rebuilt from it where the engine
+        // takes fixed spots, so the next pack can extend it.
+        const auto key = request_key(request);
+        if (full)
+        {
+            if (const auto* ent = _cache.find(key, request._ids.size()))
+            {
+                layout._ids       = request._ids;
+                layout._settings  = settings;
+                layout._positions = ent->_positions;
+                layout._pages     = ent->_pages;
+                layout._width     = ent->_width;
+                layout._height    = ent->_height;
+                layout._heuristic = ent->_heuristic;
+                layout._order     = ent->_order;
+                layout._complete  = std::all_of(
+                    ent->_positions.begin(), ent->_positions.end(), [](const maxRectsPosition& pos) { return pos.used != 0; });
+
+                _valid = seed(request, ent->_positions.data(), ent->_pages.data(), ent->_width, ent->_height, ent->_heuristic);
+                if (_valid)
+                    _packed_occupancy = _packer.occupancy();
+                return true;
+            }
+        }
+
+        if (reseed)
+        {
+            full = request._previous.size() != request._ids.size() || request._previous_pages.size() != request._ids.size() ||
+                   !seed(request, request._previous.data(), request._previous_pages.data(), settings._width, settings._height, settings._heuristic);
+            if (!full)
+                _packed_occupancy = _packer.occupancy();
+        }
+
+        // Sprites gone since the last layout hand their space back; once that
+        // leaves the atlas too sparse compared to the last full pack, start
+        // over.
+        if (!full)
+        {
+            _sorted_ids.assign(request._ids.begin(), request._ids.end());
+            std::sort(_sorted_ids.begin(), _sorted_ids.end());
+            for (auto it = _placed.begin(); it != _placed.end();)
+            {
+                if (std::binary_search(_sorted_ids.begin(), _sorted_ids.end(), it->first))
+                {
+                    ++it;
+                    continue;
+                }
+                _packer.remove(it->first);
+                it = _placed.erase(it);
+            }
+            full = _packer.occupancy() < _packed_occupancy * request._repack_threshold;
+        }
+
+        for (;;)
+        {
+            if (full)
+            {
+                _width  = settings._width;
+                _height = settings._height;
+                _placed.clear();
+                reset_packer(settings._heuristic);
+            }
+
+            // Only sprites without a place yet go through the packer. Pins
+            // that did not fit their spot stay out.
+            _rects.clear();
+            _ids.clear();
+            for (size_t n = 0; n < request._ids.size(); ++n)
+            {
+                if (_placed.count(request._ids[n]) ||
+                    std::binary_search(_pinned_ids.begin(), _pinned_ids.end(), request._ids[n]))
+                    continue;
+                _rects.emplace_back(request._rects[n]);
+                _ids.emplace_back(request._ids[n]);
+            }
+            _positions.assign(_rects.size(), {});
+            _pages.assign(_rects.size(), 0);
+
+            if (full && settings._auto_size && !_rects.empty())
+            {
+                auto limits    = settings._size_limits;
+                limits._border = settings._spacing;
+                if (_packer.find_size(_pool, limits, _rects.size(), _rects.data(), _ids.data(), _width, _height))
+                    reset_packer(settings._heuristic);
+            }
+
+            const auto before = _packer.page_count();
+            if (full && settings._heuristic == pack_heuristic_auto)
+            {
+                _packer.insert_best(_pool, _rects.size(), _rects.data(), _ids.data(), _positions.data(), _pages.data());
+
+                // The engine picked may hold fewer pins than the one reset.
+                for (const auto& pin : settings._pins)
+                {
+                    if (!_packer.contains(pin._id))
+                        _placed.erase(pin._id);
+                }
+            }
+            else
+            {
+                _packer.insert(_rects.size(), _rects.data(), _ids.data(), _positions.data(), _pages.data());
+            }
+
+            // Stopped half way, the packer holds no usable layout anymore.
+            if (_control.stopped())
+                return false;
+
+            // The free space left by earlier inserts was too fragmented and new
+            // pages had to be opened, a full pack may need fewer of them. A
+            // stable layout keeps them, later removals are measured against
+            // the grown atlas.
+            if (!full && _packer.page_count() > before)
+            {
+                if (request._stable)
+                {
+                    _packed_occupancy = _packer.occupancy();
+                    break;
+                }
+                full = true;
+                continue;
+            }
+            break;
+        }
+
+        for (size_t n = 0; n < _ids.size(); ++n)
+        {
+            if (_positions[n].used)
+                _placed[_ids[n]] = {_positions[n], _pages[n]};
+        }
+        if (full)
+            _packed_occupancy = _packer.occupancy();
+        _valid = true;
+
+        layout._ids       = request._ids;
+        layout._settings  = settings;
+        layout._width     = _width;
+        layout._height    = _height;
+        layout._heuristic = _packer.heuristic();
+        layout._order     = _packer.order();
+        layout._complete  = true;
+        layout._positions.assign(request._ids.size(), {});
+        layout._pages.assign(request._ids.size(), 0);
+        for (size_t n = 0; n < request._ids.size(); ++n)
+        {
+            auto it = _placed.find(request._ids[n]);
+            if (it == _placed.end())
+            {
+                layout._complete = false;
+                continue;
+            }
+            layout._positions[n] = it->second._position;
+            layout._pages[n]     = it->second._page;
+        }
+
+        if (full)
+        {
+            layout_cache::entry ent;
+            ent._key       = key;
+            ent._positions = layout._positions;
+            ent._pages     = layout._pages;
+            ent._width     = _width;
+            ent._height    = _height;
+            ent._heuristic = layout._heuristic;
+            ent._order     = layout._order;
+            _cache.store(std::move(ent));
+            if (!_cache_path.empty())
+                _cache.save(_cache_path.c_str());
+        }
+        return true;
+    }
+
+    bool pack_worker::seed(const pack_request& request,
+                           const maxRectsPosition* positions,
+                           const int32_t* pages,
+                           int32_t width,
+                           int32_t height,
+                           int32_t heuristic)
+    {
+        _width  = width;
+        _height = height;
+        _placed.clear();
+        reset_packer(heuristic);
+        if (!_packer.can_place())
+            return false;
+
+        // Spots taken twice or off the page are left out and packed again.
+        // Pinned sprites only ever go to their pin.
+        _seeds.assign(positions, positions + request._ids.size());
+        for (size_t n = 0; n < request._ids.size(); ++n)
+        {
+            if (std::binary_search(_pinned_ids.begin(), _pinned_ids.end(), request._ids[n]))
+                _seeds[n].used = 0;
+        }
+        _positions.assign(request._ids.size(), {});
+        _packer.place(request._ids.size(), request._rects.data(), request._ids.data(), _seeds.data(), pages, _positions.data());
+        for (size_t n = 0; n < request._ids.size(); ++n)
+        {
+            if (_positions[n].used)
+                _placed[request._ids[n]] = {_positions[n], pages[n]};
+        }
+        return true;
+    }
+
+    void pack_worker::reset_packer(int32_t heuristic)
+    {
+        _packer.set_pins(_settings._pins.size(), _settings._pins.data());
+        _packer.set_alignment(_settings._alignment);
+        _packer.reset(_width - _settings._spacing * 2,
+                      _height - _settings._spacing * 2,
+                      heuristic == pack_heuristic_auto ? rectBestShortSideFit : heuristic,
+                      _settings._order,
+                      _settings._allow_rotation,
+                      _settings._options);
+
+        for (const auto& pin : _settings._pins)
+        {
+            if (!_packer.contains(pin._id))
+                continue;
+            auto& placed          = _placed[pin._id];
+            placed._position      = {};
+            placed._position.left = pin._left;
+            placed._position.top  = pin._top;
+            placed._position.used = 1;
+            placed._page          = pin._page;
+        }
+    }
+} // namespace box
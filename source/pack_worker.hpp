@@ -0,0 +1,130 @@
+#pragma once
+
+#include "layout_cache.hpp"
+#include "packer.hpp"
+
+namespace box
+{
+    // Atlas settings a layout was packed with. Any change starts over.
+    struct pack_settings
+    {
+        pack_size_limits      _size_limits;
+        std::vector<pack_pin> _pins; // sprites at fixed spots, their ids are in the request too
+        int32_t               _width{};
+        int32_t               _height{};
+        int32_t               _padding{};
+        int32_t               _spacing{};
+        int32_t               _heuristic{};
+        int32_t               _options{};
+        int32_t               _order{pack_order::Input};
+        int32_t               _alignment{1}; // spacing is a multiple of it
+        bool                  _allow_rotation{};
+        bool                  _auto_size{};
+
+        bool operator==(const pack_settings&) const = default;
+    };
+
+    // Everything a pack depends on, copied out of the editor so the worker
+    // never touches live sprites. In stable mode, previous positions and
+    // pages, in request order, seed the packer when it holds no layout for
+    // these settings; rects with used == 0 there get a new place.
+    struct pack_request
+    {
+        std::vector<maxRectsSize>     _rects;
+        std::vector<int32_t>          _ids;
+        std::vector<maxRectsPosition> _previous;
+        std::vector<int32_t>          _previous_pages;
+        pack_settings                 _settings;
+        std::string                   _cache_path; // file for the layout cache, none when empty
+        float                         _repack_threshold{};
+        bool                          _full{};   // start over even if the last layout could be extended
+        bool                          _stable{}; // keep placed rects, only new ones move in
+    };
+
+    // Where every rect of a request ended up, in request order, and the
+    // settings it was packed with. Positions are relative to the page border;
+    // with auto size, width and height are the page size that was found, and
+    // heuristic and order are the ones auto picked.
+    struct pack_layout
+    {
+        std::vector<int32_t>          _ids;
+        std::vector<maxRectsPosition> _positions;
+        std::vector<int32_t>          _pages;
+        pack_settings                 _settings;
+        int32_t                       _width{};
+        int32_t                       _height{};
+        int32_t                       _heuristic{};
+        int32_t                       _order{};
+        bool                          _complete{};
+    };
+
+    // Packs on its own thread. A posted request replaces the one waiting and
+    // cancels the one running, so only the newest snapshot gets through.
+    // Finished layouts are built in a back buffer and swapped to the front,
+    // where fetch() picks them up.
+    class pack_worker
+    {
+    public:
+        pack_worker();
+        pack_worker(const pack_worker&)            = delete;
+        pack_worker& operator=(const pack_worker&) = delete;
+        ~pack_worker();
+
+        void post(pack_request&& request);
+        // Swaps the newest finished layout into layout, if there is one.
+        bool  fetch(pack_layout& layout);
+        void  wait();
+        bool  busy() const;
+        float progress() const;
+
+    private:
+        struct placement
+        {
+            maxRectsPosition _position{};
+            int32_t          _page{};
+        };
+
+        void run();
+        bool pack(const pack_request& request, pack_layout& layout);
+        bool seed(const pack_request& request,
+                  const maxRectsPosition* positions,
+                  const int32_t* pages,
+                  int32_t width,
+                  int32_t height,
+                  int32_t heuristic);
+        void reset_packer(int32_t heuristic);
+
+        std::thread                            _thread;
+        mutable std::mutex                     _mutex;
+        std::condition_variable                _wake;
+        std::condition_variable                _idle;
+        pack_request                           _queued;
+        pack_request                           _current;
+        pack_layout                            _front;
+        pack_layout                            _back;
+        bool                                   _has_queued{};
+        bool                                   _has_front{};
+        bool                                   _running{};
+        bool                                   _stop{};
+        pack_control                           _control;
+
+        // Worker thread only.
+        packer                                 _packer;
+        thread_pool                            _pool;
+        layout_cache                           _cache;
+        std::string                            _cache_path;
+        std::unordered_map<int32_t, placement> _placed;
+        std::vector<maxRectsSize>              _rects;
+        std::vector<int32_t>                   _ids;
+        std::vector<maxRectsPosition>          _positions;
+        std::vector<int32_t>                   _pages;
+        std::vector<int32_t>                   _sorted_ids;
+        std::vector<int32_t>                   _pinned_ids;
+        std::vector<maxRectsPosition>          _seeds;
+        pack_settings                          _settings;
+        int32_t                                _width{};
+        int32_t                                _height{};
+        float                                  _packed_occupancy{};
+        bool                                   _valid{};
+    };
+} // namespace box
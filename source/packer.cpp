@@ -0,0 +1,1099 @@
+#include "packer.hpp"
+
+namespace box
+{
+    struct packer::candidate
+    {
+        packer                        _packer;
+        std::vector<maxRectsPosition> _results;
+        std::vector<int32_t>          _pages;
+        size_t                        _unplaced{};
+        float                         _occupancy{};
+        int32_t                       _heuristic{};
+        int32_t                       _order{};
+    };
+
+    // Shortest run of one size worth a grid block, and the share of a page a
+    // block may cover. Larger blocks are too rigid to fill the space left
+    // between other rects and end up opening pages on their own.
+    static constexpr size_t  grid_min_run    = 8;
+    static constexpr int64_t grid_page_share = 32;
+
+    // Above this many rects, auto leaves out the contact point and bottom
+    // left rules. They take several times as long as the others and would
+    // hold up the whole portfolio.
+    static constexpr size_t best_portfolio_limit = 1000;
+
+    // Rect size in blocks of alignment, rounded up.
+    static int32_t blocks(int32_t size, int32_t alignment)
+    {
+        return (size + alignment - 1) / alignment;
+    }
+
+    static int64_t order_key(const maxRectsSize& rc, int32_t order)
+    {
+        switch (order)
+        {
+            case pack_order::Area:
+                return int64_t(rc.width) * rc.height;
+            case pack_order::MaxSide:
+                return std::max(rc.width, rc.height);
+            case pack_order::Perimeter:
+                return int64_t(rc.width) + rc.height;
+            case pack_order::Height:
+                return rc.height;
+        }
+        return 0;
+    }
+
+    // Page bins of one packing engine, all driven through the same calls.
+    // Streaming engines place a run from the front of the input and return
+    // its length, the rest goes to the next page. Engines with progress stop
+    // in the middle of an insert when asked to, the others only between two.
+    // Engines with place can take rects at given spots, engines with parallel
+    // spread the scoring of one insert over a pool.
+    struct pack_engine
+    {
+        void* (*create)(int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options);
+        int (*reset)(void* bin, int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options);
+        void (*destroy)(void* bin);
+        int (*insert)(void* bin, int32_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results);
+        int (*remove)(void* bin, int32_t id);
+        float (*occupancy)(void* bin);
+        void (*progress)(void* bin, maxRectsProgress progress, void* user);
+        int (*place)(void* bin, const maxRectsSize* size, const maxRectsPosition* position, int32_t id);
+        void (*parallel)(void* bin, maxRectsParallelFor parallel_for, void* user);
+        bool streaming{};
+    };
+
+    static const pack_engine maxrects_engine{
+        [](int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options) -> void*
+        {
+            auto* bin = maxRectsBinCreate(width, height, maxRectsFreeRectChoiceHeuristic(heuristic), allow_rotation);
+            if (bin)
+                maxRectsBinSetOnline(bin, (options & pack_maxrects_online) != 0);
+            return bin;
+        },
+        [](void* bin, int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options)
+        {
+            maxRectsBinSetOnline((maxRectsBin*)bin, (options & pack_maxrects_online) != 0);
+            return maxRectsBinReset(
+                (maxRectsBin*)bin, width, height, maxRectsFreeRectChoiceHeuristic(heuristic), allow_rotation);
+        },
+        [](void* bin) { maxRectsBinDestroy((maxRectsBin*)bin); },
+        [](void* bin, int32_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results)
+        { return maxRectsBinInsert((maxRectsBin*)bin, count, rects, ids, results); },
+        [](void* bin, int32_t id) { return maxRectsBinRemove((maxRectsBin*)bin, id); },
+        [](void* bin) { return maxRectsBinOccupancy((maxRectsBin*)bin); },
+        [](void* bin, maxRectsProgress progress, void* user)
+        { maxRectsBinSetProgress((maxRectsBin*)bin, progress, user); },
+        [](void* bin, const maxRectsSize* size, const maxRectsPosition* position, int32_t id)
+        { return maxRectsBinPlace((maxRectsBin*)bin, size, position, id); },
+        [](void* bin, maxRectsParallelFor parallel_for, void* user)
+        { maxRectsBinSetParallel((maxRectsBin*)bin, parallel_for, user); },
+        false,
+    };
+
+    static const pack_engine skyline_engine{
+        [](int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t) -> void*
+        {
+            return skylineBinCreate(
+                width, height, skylineHeuristic(heuristic - pack_skyline_bottom_left), allow_rotation);
+        },
+        [](void* bin, int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t)
+        {
+            return skylineBinReset(
+                (skylineBin*)bin, width, height, skylineHeuristic(heuristic - pack_skyline_bottom_left), allow_rotation);
+        },
+        [](void* bin) { skylineBinDestroy((skylineBin*)bin); },
+        [](void* bin, int32_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results)
+        { return skylineBinInsert((skylineBin*)bin, count, rects, ids, results); },
+        [](void* bin, int32_t id) { return skylineBinRemove((skylineBin*)bin, id); },
+        [](void* bin) { return skylineBinOccupancy((skylineBin*)bin); },
+        nullptr,
+        nullptr,
+        nullptr,
+        false,
+    };
+
+    static const pack_engine guillotine_engine{
+        [](int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options) -> void*
+        {
+            return guillotineBinCreate(width,
+                                       height,
+                                       guillotineFreeRectChoiceHeuristic(heuristic - pack_guillotine_area),
+                                       guillotineSplitHeuristic(options & pack_guillotine_longer_split),
+                                       (options & pack_guillotine_merge) != 0,
+                                       allow_rotation);
+        },
+        [](void* bin, int32_t width, int32_t height, int32_t heuristic, bool allow_rotation, int32_t options)
+        {
+            return guillotineBinReset((guillotineBin*)bin,
+                                      width,
+                                      height,
+                                      guillotineFreeRectChoiceHeuristic(heuristic - pack_guillotine_area),
+                                      guillotineSplitHeuristic(options & pack_guillotine_longer_split),
+                                      (options & pack_guillotine_merge) != 0,
+                                      allow_rotation);
+        },
+        [](void* bin) { guillotineBinDestroy((guillotineBin*)bin); },
+        [](void* bin, int32_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results)
+        { return guillotineBinInsert((guillotineBin*)bin, count, rects, ids, results); },
+        [](void* bin, int32_t id) { return guillotineBinRemove((guillotineBin*)bin, id); },
+        [](void* bin) { return guillotineBinOccupancy((guillotineBin*)bin); },
+        nullptr,
+        [](void* bin, const maxRectsSize* size, const maxRectsPosition* position, int32_t id)
+        { return guillotineBinPlace((guillotineBin*)bin, size, position, id); },
+        nullptr,
+        false,
+    };
+
+    static const pack_engine shelf_engine{
+        [](int32_t width, int32_t height, int32_t, bool allow_rotation, int32_t) -> void*
+        { return shelfBinCreate(width, height, allow_rotation); },
+        [](void* bin, int32_t width, int32_t height, int32_t, bool allow_rotation, int32_t)
+        { return shelfBinReset((shelfBin*)bin, width, height, allow_rotation); },
+        [](void* bin) { shelfBinDestroy((shelfBin*)bin); },
+        [](void* bin, int32_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results)
+        { return shelfBinInsert((shelfBin*)bin, count, rects, ids, results); },
+        [](void* bin, int32_t id) { return shelfBinRemove((shelfBin*)bin, id); },
+        [](void* bin) { return shelfBinOccupancy((shelfBin*)bin); },
+        nullptr,
+        nullptr,
+        nullptr,
+        true,
+    };
+
+    static const pack_engine* engine_of(int32_t heuristic)
+    {
+        if (heuristic >= pack_shelf)
+            return &shelf_engine;
+        if (heuristic >= pack_guillotine_area)
+            return &guillotine_engine;
+        if (heuristic >= pack_skyline_bottom_left)
+            return &skyline_engine;
+        return &maxrects_engine;
+    }
+
+    static int report_progress(void* user, int, int)
+    {
+        auto* control = (pack_control*)user;
+        ++control->_placed;
+        return control->stopped() ? 1 : 0;
+    }
+
+    static void run_parallel(void* user, int count, maxRectsTask task, void* data)
+    {
+        ((thread_pool*)user)->parallel_for((size_t)count, [&](size_t n) { task(data, (int)n); });
+    }
+
+    void pack_control::restart(clock::time_point deadline)
+    {
+        _cancel   = false;
+        _placed   = 0;
+        _total    = 0;
+        _deadline = deadline;
+    }
+
+    void pack_control::cancel()
+    {
+        _cancel = true;
+    }
+
+    bool pack_control::stopped() const
+    {
+        if (_cancel)
+            return true;
+        return _deadline != clock::time_point::max() && clock::now() >= _deadline;
+    }
+
+    float pack_control::progress() const
+    {
+        const auto total = _total.load();
+        return total ? std::min(1.f, float(double(_placed.load()) / double(total))) : 0.f;
+    }
+
+    static bool valid_size(const pack_size_limits& limits, int32_t size)
+    {
+        if (limits._power_of_two && (size & (size - 1)))
+            return false;
+        if (limits._multiple_of_4 && (size % 4))
+            return false;
+        return true;
+    }
+
+    static void valid_sizes(const pack_size_limits& limits, int32_t from, std::vector<int32_t>& out)
+    {
+        out.clear();
+        for (int32_t size = std::max(from, 1); size <= limits._max_size; ++size)
+        {
+            if (valid_size(limits, size))
+                out.emplace_back(size);
+        }
+    }
+
+    packer::packer() = default;
+
+    packer::packer(packer&& other) noexcept
+    {
+        swap(other);
+    }
+
+    packer& packer::operator=(packer&& other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    packer::~packer()
+    {
+        destroy_bins();
+    }
+
+    void packer::destroy_bins()
+    {
+        for (auto* bin : _bins)
+        {
+            _engine->destroy(bin);
+        }
+        _bins.clear();
+        _used_bins = 0;
+    }
+
+    void packer::swap(packer& other) noexcept
+    {
+        // Scratch buffers, candidates, the control and the pool stay with their owner.
+        std::swap(_engine, other._engine);
+        std::swap(_bins, other._bins);
+        std::swap(_used_bins, other._used_bins);
+        std::swap(_id_page, other._id_page);
+        std::swap(_width, other._width);
+        std::swap(_height, other._height);
+        std::swap(_bin_width, other._bin_width);
+        std::swap(_bin_height, other._bin_height);
+        std::swap(_alignment, other._alignment);
+        std::swap(_heuristic, other._heuristic);
+        std::swap(_order, other._order);
+        std::swap(_options, other._options);
+        std::swap(_allow_rotation, other._allow_rotation);
+        std::swap(_pins, other._pins);
+        std::swap(_pinned, other._pinned);
+        std::swap(_blocks, other._blocks);
+        std::swap(_block_of, other._block_of);
+        std::swap(_next_block, other._next_block);
+    }
+
+    void packer::set_control(pack_control* control)
+    {
+        _control = control;
+    }
+
+    void packer::set_pool(thread_pool* pool)
+    {
+        _pool = pool;
+    }
+
+    bool packer::stopped() const
+    {
+        return _control && _control->stopped();
+    }
+
+    void packer::reset(int32_t width, int32_t height, int32_t heuristic, int32_t order, bool allow_rotation, int32_t options)
+    {
+        // Bins of another engine cannot be recycled.
+        const auto* engine = engine_of(heuristic);
+        if (engine != _engine)
+        {
+            destroy_bins();
+            _engine = engine;
+        }
+
+        _width          = width;
+        _height         = height;
+        _bin_width      = width / _alignment;
+        _bin_height     = height / _alignment;
+        _heuristic      = heuristic;
+        _order          = order;
+        _options        = options;
+        _allow_rotation = allow_rotation;
+        _used_bins      = 0;
+        _next_block     = 0;
+        _id_page.clear();
+        _blocks.clear();
+        _block_of.clear();
+        place_pins();
+    }
+
+    void packer::set_pins(size_t count, const pack_pin* pins)
+    {
+        _pins.assign(pins, pins + count);
+    }
+
+    bool packer::contains(int32_t id) const
+    {
+        return _id_page.count(id) != 0;
+    }
+
+    void packer::place_pins()
+    {
+        _pinned = 0;
+        if (!_engine->place)
+            return;
+
+        for (const auto& pin : _pins)
+        {
+            if (pin._page < 0 || pin._left % _alignment || pin._top % _alignment)
+                continue;
+            while (_used_bins <= (size_t)pin._page)
+            {
+                if (!open_page())
+                    return;
+            }
+
+            const maxRectsSize size{blocks(pin._width, _alignment), blocks(pin._height, _alignment)};
+            maxRectsPosition   pos{};
+            pos.left = pin._left / _alignment;
+            pos.top  = pin._top / _alignment;
+            pos.used = 1;
+            if (_engine->place(_bins[pin._page], &size, &pos, pin._id))
+                continue;
+            _id_page[pin._id] = pin._page;
+            ++_pinned;
+        }
+    }
+
+    void* packer::open_page()
+    {
+        // Pages from an earlier layout are recycled to keep their buffers.
+        if (_used_bins < _bins.size())
+        {
+            auto* bin = _bins[_used_bins];
+            if (_engine->reset(bin, _bin_width, _bin_height, _heuristic, _allow_rotation, _options))
+                return nullptr;
+            ++_used_bins;
+            return bin;
+        }
+
+        auto* bin = _engine->create(_bin_width, _bin_height, _heuristic, _allow_rotation, _options);
+        if (!bin)
+            return nullptr;
+        _bins.emplace_back(bin);
+        ++_used_bins;
+        return bin;
+    }
+
+    void packer::set_alignment(int32_t alignment)
+    {
+        _alignment = std::max(alignment, 1);
+    }
+
+    bool packer::insert(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages)
+    {
+        if (_alignment == 1)
+            return insert_grid(count, rects, ids, results, pages);
+
+        // Packed in blocks and scaled back, so engines score aligned spots
+        // without seeing the rounding.
+        _aligned.resize(count);
+        for (size_t n = 0; n < count; ++n)
+        {
+            _aligned[n] = {blocks(rects[n].width, _alignment), blocks(rects[n].height, _alignment)};
+            results[n]  = {};
+        }
+        const auto ret = insert_grid(count, _aligned.data(), ids, results, pages);
+        for (size_t n = 0; n < count; ++n)
+        {
+            if (!results[n].used)
+                continue;
+            results[n].left *= _alignment;
+            results[n].top *= _alignment;
+        }
+        return ret;
+    }
+
+    bool packer::insert_grid(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages)
+    {
+        if (!(_options & pack_grid_runs) || count < grid_min_run)
+            return insert_rects(count, rects, ids, results, pages);
+
+        // Runs of one size, each in input order.
+        auto size_key = [](const maxRectsSize& rc) { return (int64_t(rc.width) << 32) | uint32_t(rc.height); };
+        _grid_index.resize(count);
+        for (size_t n = 0; n < count; ++n)
+        {
+            _grid_index[n] = n;
+        }
+        std::stable_sort(_grid_index.begin(),
+                         _grid_index.end(),
+                         [&](size_t a, size_t b) { return size_key(rects[a]) < size_key(rects[b]); });
+
+        const auto max_area = int64_t(_bin_width) * _bin_height / grid_page_share;
+        _grid_run.assign(count, -1);
+        _grid_runs.clear();
+        for (size_t first = 0, last = 0; first < count; first = last)
+        {
+            const auto& cell = rects[_grid_index[first]];
+            for (last = first + 1; last < count && size_key(rects[_grid_index[last]]) == size_key(cell); ++last)
+            {
+            }
+            if (last - first < grid_min_run || cell.width <= 0 || cell.height <= 0 || cell.width > _bin_width ||
+                cell.height > _bin_height || max_area / (int64_t(cell.width) * cell.height) < (int64_t)grid_min_run)
+                continue;
+
+            for (auto n = first; n < last; ++n)
+            {
+                _grid_run[_grid_index[n]] = int32_t(_grid_runs.size() / 2);
+            }
+            _grid_runs.emplace_back(first);
+            _grid_runs.emplace_back(last);
+        }
+        if (_grid_runs.empty())
+            return insert_rects(count, rects, ids, results, pages);
+
+        // Blocks of a run take its place in the input, where its first rect was.
+        _grid_rects.clear();
+        _grid_ids.clear();
+        _grid_source.clear();
+        for (size_t n = 0; n < count; ++n)
+        {
+            const auto run = _grid_run[n];
+            if (run < 0)
+            {
+                _grid_rects.emplace_back(rects[n]);
+                _grid_ids.emplace_back(ids[n]);
+                _grid_source.emplace_back(int64_t(n));
+            }
+            else if (_grid_index[_grid_runs[run * 2]] == n)
+            {
+                add_blocks(rects, ids, _grid_runs[run * 2], _grid_runs[run * 2 + 1]);
+            }
+        }
+
+        _grid_results.assign(_grid_rects.size(), {});
+        _grid_pages.assign(_grid_rects.size(), 0);
+        const auto ret = insert_rects(
+            _grid_rects.size(), _grid_rects.data(), _grid_ids.data(), _grid_results.data(), _grid_pages.data());
+
+        for (size_t n = 0; n < _grid_rects.size(); ++n)
+        {
+            const auto& pos  = _grid_results[n];
+            const auto  page = _grid_pages[n];
+            const auto  src  = _grid_source[n];
+            if (!pos.used)
+            {
+                if (src < 0)
+                    _blocks.erase(_grid_ids[n]);
+                continue;
+            }
+            if (src >= 0)
+            {
+                results[src] = pos;
+                pages[src]   = page;
+                continue;
+            }
+
+            // A rotated block holds its cells rotated, rows turned to columns.
+            auto& blk = _blocks[_grid_ids[n]];
+            blk._positions.resize(blk._ids.size());
+            for (size_t k = 0; k < blk._ids.size(); ++k)
+            {
+                const auto column = int32_t(k % blk._columns);
+                const auto row    = int32_t(k / blk._columns);
+                auto&      cell   = blk._positions[k];
+                cell              = pos;
+                cell.left         = pos.left + (pos.rotated ? row * blk._cell.height : column * blk._cell.width);
+                cell.top          = pos.top + (pos.rotated ? column * blk._cell.width : row * blk._cell.height);
+
+                const auto i           = _grid_index[size_t(~src) + k];
+                results[i]             = cell;
+                pages[i]               = page;
+                _id_page[blk._ids[k]]  = page;
+                _block_of[blk._ids[k]] = _grid_ids[n];
+            }
+        }
+        return ret;
+    }
+
+    void packer::add_blocks(const maxRectsSize* rects, const int32_t* ids, size_t first, size_t last)
+    {
+        // Close to square blocks of full rows. What is too short for another
+        // block goes in rect by rect.
+        const auto cell      = rects[_grid_index[first]];
+        const auto max_cells = int64_t(_bin_width) * _bin_height / grid_page_share / (int64_t(cell.width) * cell.height);
+        while (last - first >= grid_min_run)
+        {
+            const auto cells   = std::min<int64_t>(int64_t(last - first), max_cells);
+            auto       columns = std::clamp(
+                int32_t(std::ceil(std::sqrt(double(cells) * cell.height / cell.width))), 1, _bin_width / cell.width);
+            auto rows = std::min<int64_t>(cells / columns, _bin_height / cell.height);
+            if (!rows)
+            {
+                columns = int32_t(cells);
+                rows    = 1;
+            }
+
+            const auto id = --_next_block;
+            auto&      blk = _blocks[id];
+            blk._ids.clear();
+            blk._positions.clear();
+            blk._cell    = cell;
+            blk._columns = columns;
+            for (int64_t n = 0; n < columns * rows; ++n)
+            {
+                blk._ids.emplace_back(ids[_grid_index[first + n]]);
+            }
+
+            _grid_rects.push_back({columns * cell.width, int32_t(rows) * cell.height});
+            _grid_ids.emplace_back(id);
+            _grid_source.emplace_back(~int64_t(first));
+            first += size_t(columns * rows);
+        }
+        for (; first < last; ++first)
+        {
+            _grid_rects.emplace_back(rects[_grid_index[first]]);
+            _grid_ids.emplace_back(ids[_grid_index[first]]);
+            _grid_source.emplace_back(int64_t(_grid_index[first]));
+        }
+    }
+
+    bool packer::insert_rects(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages)
+    {
+        if (_control)
+            _control->_total += count;
+        if (_engine->streaming)
+            return insert_streaming(count, rects, ids, results, pages);
+
+        _index.resize(count);
+        for (size_t n = 0; n < count; ++n)
+        {
+            _index[n] = n;
+        }
+        if (_order != pack_order::Input)
+        {
+            std::stable_sort(_index.begin(),
+                             _index.end(),
+                             [this, rects](size_t a, size_t b)
+                             { return order_key(rects[a], _order) > order_key(rects[b], _order); });
+        }
+
+        for (size_t page = 0; !_index.empty(); ++page)
+        {
+            if (stopped())
+                return false;
+
+            const bool fresh = page >= _used_bins;
+            auto*      bin   = fresh ? open_page() : _bins[page];
+            if (!bin)
+                return false;
+
+            _rects.clear();
+            _ids.clear();
+            _results.assign(_index.size(), {});
+            for (auto i : _index)
+            {
+                _rects.emplace_back(rects[i]);
+                _ids.emplace_back(ids[i]);
+            }
+
+            if (_engine->progress)
+                _engine->progress(bin, _control ? report_progress : nullptr, _control);
+            if (_engine->parallel)
+                _engine->parallel(bin, _pool ? run_parallel : nullptr, _pool);
+            _engine->insert(bin, (int32_t)_rects.size(), _rects.data(), _ids.data(), _results.data());
+
+            size_t left = 0;
+            for (size_t n = 0; n < _index.size(); ++n)
+            {
+                const auto i = _index[n];
+                if (_results[n].used)
+                {
+                    results[i]       = _results[n];
+                    pages[i]         = (int32_t)page;
+                    _id_page[ids[i]] = (int32_t)page;
+                }
+                else
+                {
+                    _index[left++] = i;
+                }
+            }
+
+            if (_control && !_engine->progress)
+                _control->_placed += int64_t(_index.size() - left);
+
+            // Nothing went onto an empty page, so the rest is larger than a page.
+            if (fresh && left == _index.size())
+            {
+                --_used_bins;
+                return false;
+            }
+            _index.resize(left);
+        }
+        return true;
+    }
+
+    bool packer::insert_streaming(size_t count,
+                                  maxRectsSize* rects,
+                                  const int32_t* ids,
+                                  maxRectsPosition* results,
+                                  int32_t* pages)
+    {
+        // Sorted once by the height the rects will have on a row, then every
+        // page takes the next run of them. Pages before the last one are full
+        // and never visited again.
+        auto shelf_height = [this](const maxRectsSize& rc)
+        {
+            if (_allow_rotation && std::max(rc.width, rc.height) <= _bin_width)
+                return std::min(rc.width, rc.height);
+            return rc.height;
+        };
+
+        _index.resize(count);
+        for (size_t n = 0; n < count; ++n)
+        {
+            _index[n] = n;
+        }
+        std::stable_sort(_index.begin(),
+                         _index.end(),
+                         [&](size_t a, size_t b) { return shelf_height(rects[a]) > shelf_height(rects[b]); });
+
+        _rects.clear();
+        _ids.clear();
+        _results.assign(count, {});
+        for (auto i : _index)
+        {
+            _rects.emplace_back(rects[i]);
+            _ids.emplace_back(ids[i]);
+        }
+
+        bool   ret  = true;
+        size_t next = 0;
+        for (size_t page = _used_bins ? _used_bins - 1 : 0; next < count; ++page)
+        {
+            if (stopped())
+                return false;
+
+            const bool fresh = page >= _used_bins;
+            auto*      bin   = fresh ? open_page() : _bins[page];
+            if (!bin)
+                return false;
+
+            const auto taken = (size_t)_engine->insert(
+                bin, int32_t(count - next), _rects.data() + next, _ids.data() + next, _results.data() + next);
+
+            bool placed = false;
+            for (auto n = next; n < next + taken; ++n)
+            {
+                const auto i = _index[n];
+                if (_results[n].used)
+                {
+                    results[i]       = _results[n];
+                    pages[i]         = (int32_t)page;
+                    _id_page[ids[i]] = (int32_t)page;
+                    placed           = true;
+                }
+                else
+                {
+                    ret = false;
+                }
+            }
+            next += taken;
+            if (_control)
+                _control->_placed += int64_t(taken);
+
+            if (fresh && !placed)
+            {
+                --_used_bins;
+                return false;
+            }
+        }
+        return ret;
+    }
+
+    bool packer::can_place() const
+    {
+        return _engine && _engine->place;
+    }
+
+    size_t packer::place(size_t count,
+                         const maxRectsSize* rects,
+                         const int32_t* ids,
+                         const maxRectsPosition* positions,
+                         const int32_t* pages,
+                         maxRectsPosition* results)
+    {
+        size_t placed = 0;
+        for (size_t n = 0; n < count; ++n)
+        {
+            const auto& pos = positions[n];
+            if (!pos.used || pages[n] < 0 || (pos.rotated && !_allow_rotation) || pos.left % _alignment ||
+                pos.top % _alignment)
+                continue;
+
+            while (_used_bins <= (size_t)pages[n])
+            {
+                if (!open_page())
+                    return placed;
+            }
+            const maxRectsSize size{blocks(rects[n].width, _alignment), blocks(rects[n].height, _alignment)};
+            auto               spot = pos;
+            spot.left /= _alignment;
+            spot.top /= _alignment;
+            if (_engine->place(_bins[pages[n]], &size, &spot, ids[n]))
+                continue;
+
+            results[n]       = pos;
+            _id_page[ids[n]] = pages[n];
+            ++placed;
+        }
+        return placed;
+    }
+
+    bool packer::remove(int32_t id)
+    {
+        auto it = _id_page.find(id);
+        if (it == _id_page.end())
+            return false;
+
+        const auto page = it->second;
+        _id_page.erase(it);
+
+        auto cell = _block_of.find(id);
+        if (cell == _block_of.end())
+            return _engine->remove(_bins[page], id) == 0;
+
+        // A cell leaves its block. Engines that take fixed spots get the other
+        // cells back as rects of their own, the rest keep the hole until the
+        // block is empty.
+        const auto block_id = cell->second;
+        _block_of.erase(cell);
+        auto&      blk = _blocks[block_id];
+        const auto k   = std::find(blk._ids.begin(), blk._ids.end(), id) - blk._ids.begin();
+        blk._ids.erase(blk._ids.begin() + k);
+        blk._positions.erase(blk._positions.begin() + k);
+        if (!_engine->place && !blk._ids.empty())
+            return true;
+
+        const auto ret = _engine->remove(_bins[page], block_id) == 0;
+        for (size_t n = 0; n < blk._ids.size(); ++n)
+        {
+            _engine->place(_bins[page], &blk._cell, &blk._positions[n], blk._ids[n]);
+            _block_of.erase(blk._ids[n]);
+        }
+        _id_page.erase(block_id);
+        _blocks.erase(block_id);
+        return ret;
+    }
+
+    bool packer::insert_best(thread_pool& pool,
+                             size_t count,
+                             maxRectsSize* rects,
+                             const int32_t* ids,
+                             maxRectsPosition* results,
+                             int32_t* pages)
+    {
+        // Every heuristic but auto itself, with every order. The streaming
+        // engine sorts the rects its own way, so it packs only once.
+        _candidates.clear();
+        for (int32_t order = 0; order < pack_order::OrderCount; ++order)
+        {
+            for (int32_t heuristic = 0; heuristic < pack_heuristic_count; ++heuristic)
+            {
+                if (heuristic == pack_heuristic_auto || (order != pack_order::Input && engine_of(heuristic)->streaming))
+                    continue;
+                if (count > best_portfolio_limit && (heuristic == rectContactPointRule || heuristic == rectBottomLeftRule))
+                    continue;
+                auto& cnd      = _candidates.emplace_back();
+                cnd._heuristic = heuristic;
+                cnd._order     = order;
+            }
+        }
+        const auto total = _candidates.size();
+
+        pool.parallel_for(total,
+                          [&](size_t n)
+                          {
+                              if (stopped())
+                                  return;
+
+                              auto& cnd = _candidates[n];
+                              cnd._packer.set_control(_control);
+                              cnd._packer.set_pins(_pins.size(), _pins.data());
+                              cnd._packer.set_alignment(_alignment);
+                              cnd._packer.reset(
+                                  _width, _height, cnd._heuristic, cnd._order, _allow_rotation, _options);
+                              cnd._results.assign(count, {});
+                              cnd._pages.assign(count, 0);
+                              cnd._packer.insert(count, rects, ids, cnd._results.data(), cnd._pages.data());
+
+                              // Occupancy of the pages trimmed to their content.
+                              // Pins an engine cannot hold count as unplaced.
+                              std::vector<std::pair<int32_t, int32_t>> extent(cnd._packer.page_count());
+                              int64_t                                  used = 0;
+                              cnd._unplaced                                   = _pins.size() - cnd._packer._pinned;
+                              for (const auto& pin : _pins)
+                              {
+                                  if (!cnd._packer.contains(pin._id))
+                                      continue;
+                                  auto& ex  = extent[pin._page];
+                                  ex.first  = std::max(ex.first, pin._left + pin._width);
+                                  ex.second = std::max(ex.second, pin._top + pin._height);
+                                  used += int64_t(pin._width) * pin._height;
+                              }
+                              for (size_t i = 0; i < count; ++i)
+                              {
+                                  const auto& pos = cnd._results[i];
+                                  if (!pos.used)
+                                  {
+                                      ++cnd._unplaced;
+                                      continue;
+                                  }
+                                  const auto w  = pos.rotated ? rects[i].height : rects[i].width;
+                                  const auto h  = pos.rotated ? rects[i].width : rects[i].height;
+                                  auto&      ex = extent[cnd._pages[i]];
+                                  ex.first      = std::max(ex.first, pos.left + w);
+                                  ex.second     = std::max(ex.second, pos.top + h);
+                                  used += int64_t(w) * h;
+                              }
+                              int64_t area = 0;
+                              for (auto& ex : extent)
+                              {
+                                  area += int64_t(ex.first) * ex.second;
+                              }
+                              cnd._occupancy = area ? float(double(used) / double(area)) : 0.f;
+                          });
+        if (stopped())
+        {
+            _candidates.clear();
+            return false;
+        }
+
+        size_t best = 0;
+        for (size_t n = 1; n < total; ++n)
+        {
+            const auto& a = _candidates[n];
+            const auto& b = _candidates[best];
+            if (a._unplaced != b._unplaced)
+            {
+                if (a._unplaced < b._unplaced)
+                    best = n;
+            }
+            else if (a._packer._used_bins != b._packer._used_bins)
+            {
+                if (a._packer._used_bins < b._packer._used_bins)
+                    best = n;
+            }
+            else if (a._occupancy > b._occupancy)
+            {
+                best = n;
+            }
+        }
+
+        // The losers and the layout swapped out hold a page worth of bins
+        // each, they go right away.
+        auto& winner = _candidates[best];
+        swap(winner._packer);
+        std::copy(winner._results.begin(), winner._results.end(), results);
+        std::copy(winner._pages.begin(), winner._pages.end(), pages);
+        const auto complete = winner._unplaced == 0;
+        _candidates.clear();
+        return complete;
+    }
+
+    bool packer::find_size(thread_pool& pool,
+                           const pack_size_limits& limits,
+                           size_t count,
+                           maxRectsSize* rects,
+                           const int32_t* ids,
+                           int32_t& width,
+                           int32_t& height)
+    {
+        int32_t min_width  = 1;
+        int32_t min_height = 1;
+        int64_t area       = 0;
+        for (size_t n = 0; n < count; ++n)
+        {
+            const auto& rc = rects[n];
+            min_width      = std::max(min_width, _allow_rotation ? std::min(rc.width, rc.height) : rc.width);
+            min_height     = std::max(min_height, _allow_rotation ? std::min(rc.width, rc.height) : rc.height);
+            area += int64_t(rc.width) * rc.height;
+        }
+        for (const auto& pin : _pins)
+        {
+            min_width  = std::max(min_width, pin._left + pin._width);
+            min_height = std::max(min_height, pin._top + pin._height);
+            area += int64_t(pin._width) * pin._height;
+        }
+        min_width += limits._border * 2;
+        min_height += limits._border * 2;
+        if (limits._square)
+            min_width = min_height = std::max(min_width, min_height);
+
+        valid_sizes(limits, min_width, _widths);
+        valid_sizes(limits, min_height, _heights);
+        if (_widths.empty() || _heights.empty())
+            return false;
+
+        const auto slots = std::min(pool.size(), _widths.size());
+        if (_candidates.size() < slots)
+            _candidates.resize(slots);
+
+        auto fits = [&](candidate& cnd, int32_t w, int32_t h)
+        {
+            cnd._packer.set_control(_control);
+            cnd._packer.set_pins(_pins.size(), _pins.data());
+            cnd._packer.set_alignment(_alignment);
+            cnd._packer.reset(
+                w - limits._border * 2, h - limits._border * 2, _heuristic, _order, _allow_rotation, _options);
+            cnd._results.assign(count, {});
+            cnd._pages.assign(count, 0);
+            return cnd._packer._pinned == _pins.size() &&
+                   cnd._packer.insert(count, rects, ids, cnd._results.data(), cnd._pages.data()) &&
+                   cnd._packer.page_count() <= 1;
+        };
+
+        // Every slot keeps one packer and works through the widths with a
+        // stride. A width whose smallest possible page is already larger than
+        // the best one found so far is skipped.
+        std::atomic<int64_t> best_area{INT64_MAX};
+        std::vector<size_t>  tried;
+        auto                 search = [&]()
+        {
+            pool.parallel_for(slots,
+                              [&](size_t slot)
+                              {
+                                  auto& cnd = _candidates[slot];
+                                  for (size_t i = slot; i < tried.size() && !stopped(); i += slots)
+                                  {
+                                      const auto w = _widths[tried[i]];
+                                      if (limits._square)
+                                      {
+                                          if (fits(cnd, w, w))
+                                              _found[tried[i]] = w;
+                                          continue;
+                                      }
+
+                                      const auto need = (area + w - 1) / w;
+                                      size_t     lo   = std::lower_bound(_heights.begin(), _heights.end(), need) - _heights.begin();
+                                      size_t     hi   = _heights.size() - 1;
+                                      if (lo > hi || int64_t(w) * _heights[lo] > best_area.load() || !fits(cnd, w, _heights[hi]))
+                                          continue;
+
+                                      while (lo < hi)
+                                      {
+                                          const auto mid = (lo + hi) / 2;
+                                          if (fits(cnd, w, _heights[mid]))
+                                              hi = mid;
+                                          else
+                                              lo = mid + 1;
+                                      }
+                                      _found[tried[i]] = _heights[hi];
+
+                                      const int64_t size = int64_t(w) * _heights[hi];
+                                      for (auto cur = best_area.load(); size < cur && !best_area.compare_exchange_weak(cur, size);)
+                                      {
+                                      }
+                                  }
+                              });
+        };
+
+        // Smallest area wins, then the more square page, then the narrower one.
+        auto pick = [&]()
+        {
+            size_t best = _widths.size();
+            for (auto i : tried)
+            {
+                if (!_found[i])
+                    continue;
+                if (best == _widths.size())
+                {
+                    best = i;
+                    continue;
+                }
+                const int64_t a = int64_t(_widths[i]) * _found[i];
+                const int64_t b = int64_t(_widths[best]) * _found[best];
+                if (a != b)
+                {
+                    if (a < b)
+                        best = i;
+                }
+                else if (std::max(_widths[i], _found[i]) != std::max(_widths[best], _found[best]))
+                {
+                    if (std::max(_widths[i], _found[i]) < std::max(_widths[best], _found[best]))
+                        best = i;
+                }
+                else if (i < best)
+                {
+                    best = i;
+                }
+            }
+            return best;
+        };
+
+        // A coarse pass over at most 64 widths, then every width around the
+        // best coarse one.
+        _found.assign(_widths.size(), 0);
+        const auto stride = std::max<size_t>(1, _widths.size() / 64);
+        for (size_t i = 0; i < _widths.size(); i += stride)
+        {
+            tried.emplace_back(i);
+        }
+        if (tried.back() != _widths.size() - 1)
+            tried.emplace_back(_widths.size() - 1);
+        search();
+        if (stopped())
+            return false;
+
+        auto best = pick();
+        if (best == _widths.size())
+            return false;
+
+        if (stride > 1)
+        {
+            tried.clear();
+            const auto first = best > stride ? best - stride + 1 : 0;
+            const auto last  = std::min(best + stride, _widths.size());
+            for (auto i = first; i < last; ++i)
+            {
+                if (i != best)
+                    tried.emplace_back(i);
+            }
+            search();
+            if (stopped())
+                return false;
+            tried.emplace_back(best);
+            best = pick();
+        }
+
+        width  = _widths[best];
+        height = _found[best];
+        return true;
+    }
+
+    float packer::occupancy() const
+    {
+        if (!_used_bins)
+            return 0.f;
+
+        float sum = 0.f;
+        for (size_t n = 0; n < _used_bins; ++n)
+        {
+            sum += _engine->occupancy(_bins[n]);
+        }
+        return sum / _used_bins;
+    }
+
+    size_t packer::page_count() const
+    {
+        return _used_bins;
+    }
+
+    int32_t packer::heuristic() const
+    {
+        return _heuristic;
+    }
+
+    int32_t packer::order() const
+    {
+        return _order;
+    }
+} // namespace box
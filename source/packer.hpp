@@ -0,0 +1,227 @@
+#pragma once
+
+#include "include.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace box
+{
+    // Order in which rects are handed to the packer.
+    enum pack_order : int32_t
+    {
+        Input,
+        Area,
+        MaxSide,
+        Perimeter,
+        Height,
+        OrderCount,
+    };
+
+    // Packing algorithms past the maxRects heuristics. Auto tries every other
+    // one and keeps the best layout.
+    constexpr int32_t pack_heuristic_auto      = rectContactPointRule + 1;
+    constexpr int32_t pack_skyline_bottom_left = pack_heuristic_auto + 1;
+    constexpr int32_t pack_skyline_best_fit    = pack_skyline_bottom_left + 1;
+    constexpr int32_t pack_guillotine_area     = pack_skyline_best_fit + 1;
+    constexpr int32_t pack_guillotine_short    = pack_guillotine_area + 1;
+    constexpr int32_t pack_guillotine_long     = pack_guillotine_short + 1;
+    constexpr int32_t pack_shelf               = pack_guillotine_long + 1;
+    constexpr int32_t pack_heuristic_count     = pack_shelf + 1;
+
+    // Flags for packer::reset(). The guillotine ones only matter to that engine.
+    constexpr int32_t pack_guillotine_longer_split = 1 << 0; // cut along the axis with more space left
+    constexpr int32_t pack_guillotine_merge        = 1 << 1; // join free rects sharing a whole edge
+    constexpr int32_t pack_grid_runs               = 1 << 2; // place runs of same size rects as grid blocks
+    constexpr int32_t pack_maxrects_online         = 1 << 3; // place rects one by one in the reset() order
+
+    // Constraints for the smallest page search.
+    struct pack_size_limits
+    {
+        int32_t _max_size{4096};
+        int32_t _border{}; // kept free on every side of the page
+        bool    _power_of_two{};
+        bool    _square{};
+        bool    _multiple_of_4{};
+
+        bool operator==(const pack_size_limits&) const = default;
+    };
+
+    // A rect held at a fixed spot of a page, relative to the page border.
+    // Pins are never rotated.
+    struct pack_pin
+    {
+        int32_t _id{};
+        int32_t _left{};
+        int32_t _top{};
+        int32_t _width{};
+        int32_t _height{};
+        int32_t _page{};
+
+        bool operator==(const pack_pin&) const = default;
+    };
+
+    // Lets another thread or a deadline stop a running pack, and counts the
+    // rects it placed. The owner resets it before every pack; any thread may
+    // cancel or read the progress meanwhile.
+    struct pack_control
+    {
+        using clock = std::chrono::steady_clock;
+
+        void  restart(clock::time_point deadline = clock::time_point::max());
+        void  cancel();
+        bool  stopped() const;
+        float progress() const;
+
+        std::atomic<bool>    _cancel{};
+        std::atomic<int64_t> _placed{};
+        std::atomic<int64_t> _total{};
+        clock::time_point    _deadline{clock::time_point::max()};
+    };
+
+    struct pack_engine;
+
+    // Packs rects into as many pages of the same size as needed. Every page is
+    // a persistent bin of the engine picked by the heuristic, so rects can be
+    // inserted and removed later on without touching the ones that are
+    // already placed.
+    class packer
+    {
+    public:
+        packer();
+        packer(const packer&) = delete;
+        packer& operator=(const packer&) = delete;
+        packer(packer&& other) noexcept;
+        packer& operator=(packer&& other) noexcept;
+        ~packer();
+
+        void swap(packer& other) noexcept;
+        // Packs check control (may be null) as they go and return false once
+        // it stopped. A stopped pack leaves the layout half done; reset the
+        // packer before using it again.
+        void set_control(pack_control* control);
+        // Inserts on engines that support it score their rects on pool (may
+        // be null), with the same layout as without. Not for packers that
+        // already run on that pool, its calls do not nest.
+        void set_pool(thread_pool* pool);
+        void reset(int32_t width, int32_t height, int32_t heuristic, int32_t order, bool allow_rotation, int32_t options = 0);
+
+        // Rects every reset() puts at their spots before anything else goes
+        // in, on engines that can_place(). Pins that overlap or stick out of
+        // the page are left out; contains() tells which ones made it.
+        void set_pins(size_t count, const pack_pin* pins);
+        bool contains(int32_t id) const;
+
+        // Snaps origins and sizes of rects and pins to multiples of alignment
+        // from the next reset() on, so no two rects share a block of that
+        // size. Bins work in whole blocks, which keeps scoring exact without
+        // padding every rect. Fixed spots off the block grid are rejected.
+        void set_alignment(int32_t alignment);
+
+        // Places rects into the existing pages first and opens new pages for the
+        // rest. Returns false when some rect does not even fit an empty page;
+        // those are left with used == 0. With pack_grid_runs, long runs of one
+        // size go in as a few grid blocks, each placed like a single rect and
+        // handed back as its cells, row by row in input order.
+        bool insert(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages);
+        bool remove(int32_t id);
+
+        // Puts rects back where an earlier layout had them, opening pages up
+        // to the last one used. Rects whose spot is no longer free, or that
+        // are rotated when rotation is off, are skipped and keep used == 0
+        // in results. Only engines that can_place() take fixed spots.
+        bool   can_place() const;
+        size_t place(size_t count,
+                     const maxRectsSize* rects,
+                     const int32_t* ids,
+                     const maxRectsPosition* positions,
+                     const int32_t* pages,
+                     maxRectsPosition* results);
+
+        // Packs rects into the emptied packer once per heuristic and input
+        // order on the pool, then keeps the layout with the fewest pages and
+        // the highest occupancy of its trimmed pages. Large inputs leave out
+        // the slowest maxRects rules, see best_portfolio_limit.
+        bool insert_best(thread_pool& pool,
+                         size_t count,
+                         maxRectsSize* rects,
+                         const int32_t* ids,
+                         maxRectsPosition* results,
+                         int32_t* pages);
+
+        // Looks for the smallest page within limits that takes all rects and
+        // pins, using the heuristic, order and rotation of the last reset(). Widths
+        // are tried in parallel, each one binary searching its height. The
+        // layout of this packer is left untouched.
+        bool find_size(thread_pool& pool,
+                       const pack_size_limits& limits,
+                       size_t count,
+                       maxRectsSize* rects,
+                       const int32_t* ids,
+                       int32_t& width,
+                       int32_t& height);
+
+        float   occupancy() const;
+        size_t  page_count() const;
+        int32_t heuristic() const;
+        int32_t order() const;
+
+    private:
+        struct candidate;
+
+        // Cells of a grid block, placed in the bins as one rect under its own
+        // negative id.
+        struct block
+        {
+            std::vector<int32_t>          _ids;
+            std::vector<maxRectsPosition> _positions;
+            maxRectsSize                  _cell{};
+            int32_t                       _columns{};
+        };
+
+        bool  stopped() const;
+        void* open_page();
+        void  place_pins();
+        bool  insert_grid(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages);
+        bool  insert_rects(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages);
+        bool  insert_streaming(size_t count, maxRectsSize* rects, const int32_t* ids, maxRectsPosition* results, int32_t* pages);
+        void  add_blocks(const maxRectsSize* rects, const int32_t* ids, size_t first, size_t last);
+        void  destroy_bins();
+
+        const pack_engine*                   _engine{};
+        pack_control*                        _control{};
+        thread_pool*                         _pool{};
+        std::vector<void*>                   _bins;
+        size_t                               _used_bins{};
+        std::unordered_map<int32_t, int32_t> _id_page;
+        std::vector<maxRectsSize>            _rects;
+        std::vector<maxRectsPosition>        _results;
+        std::vector<int32_t>                 _ids;
+        std::vector<size_t>                  _index;
+        std::vector<candidate>               _candidates;
+        std::vector<int32_t>                 _widths;
+        std::vector<int32_t>                 _heights;
+        std::vector<int32_t>                 _found;
+        std::vector<pack_pin>                _pins;
+        size_t                               _pinned{};
+        std::unordered_map<int32_t, block>   _blocks;   // by block id
+        std::unordered_map<int32_t, int32_t> _block_of; // block id of every cell
+        std::vector<size_t>                  _grid_index;
+        std::vector<int32_t>                 _grid_run;  // run of every input rect, -1 for none
+        std::vector<size_t>                  _grid_runs; // first and last of every run in _grid_index
+        std::vector<maxRectsSize>            _grid_rects;
+        std::vector<int32_t>                 _grid_ids;
+        std::vector<int64_t>                 _grid_source; // input index, or ~first cell in _grid_index
+        std::vector<maxRectsPosition>        _grid_results;
+        std::vector<int32_t>                 _grid_pages;
+        std::vector<maxRectsSize>            _aligned;
+        int32_t                              _next_block{};
+        int32_t                              _width{};
+        int32_t                              _height{};
+        int32_t                              _bin_width{}; // in blocks of alignment
+        int32_t                              _bin_height{};
+        int32_t                              _alignment{1};
+        int32_t                              _heuristic{};
+        int32_t                              _order{};
+        int32_t                              _options{};
+        bool                                 _allow_rotation{};
+    };
+} // namespace box
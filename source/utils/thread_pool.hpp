@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace box
+{
+    // Fixed set of worker threads running one parallel_for at a time. The
+    // calling thread works on the same job, so a pool of size 1 has no extra
+    // thread at all. Calls are serialized; do not nest them.
+    class thread_pool
+    {
+    public:
+        explicit thread_pool(size_t threads = std::thread::hardware_concurrency())
+        {
+            threads = threads ? threads : 1;
+            for (size_t n = 1; n < threads; ++n)
+            {
+                _threads.emplace_back([this]() { worker(); });
+            }
+        }
+
+        thread_pool(const thread_pool&)            = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        ~thread_pool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _wake.notify_all();
+            for (auto& th : _threads)
+            {
+                th.join();
+            }
+        }
+
+        size_t size() const
+        {
+            return _threads.size() + 1;
+        }
+
+        // Calls fn(index) for every index in [0, count) and returns when all of
+        // them are done.
+        void parallel_for(size_t count, const std::function<void(size_t)>& fn)
+        {
+            if (count == 0)
+                return;
+
+            std::lock_guard<std::mutex> run_lock(_run_mutex);
+            if (count == 1 || _threads.empty())
+            {
+                for (size_t n = 0; n < count; ++n)
+                {
+                    fn(n);
+                }
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _job     = &fn;
+                _count   = count;
+                _next    = 0;
+                _pending = count;
+                ++_generation;
+            }
+            _wake.notify_all();
+
+            run_job(fn, count);
+
+            // Workers still inside run_job() would pick up indices of the next job.
+            std::unique_lock<std::mutex> lock(_mutex);
+            _done.wait(lock, [this]() { return _pending == 0 && _active == 0; });
+            _job = nullptr;
+        }
+
+    private:
+        void run_job(const std::function<void(size_t)>& fn, size_t count)
+        {
+            size_t finished = 0;
+            for (size_t n = _next++; n < count; n = _next++)
+            {
+                fn(n);
+                ++finished;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending -= finished;
+            if (_pending == 0)
+                _done.notify_all();
+        }
+
+        void worker()
+        {
+            size_t generation = 0;
+            for (;;)
+            {
+                const std::function<void(size_t)>* job   = nullptr;
+                size_t                             count = 0;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait(lock, [&]() { return _stop || (_job && _generation != generation); });
+                    if (_stop)
+                        return;
+                    generation = _generation;
+                    job        = _job;
+                    count      = _count;
+                    ++_active;
+                }
+                run_job(*job, count);
+
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_active == 0)
+                    _done.notify_all();
+            }
+        }
+
+        std::vector<std::thread>               _threads;
+        std::mutex                             _run_mutex;
+        std::mutex                             _mutex;
+        std::condition_variable                _wake;
+        std::condition_variable                _done;
+        const std::function<void(size_t)>*     _job{};
+        std::atomic<size_t>                    _next{};
+        size_t                                 _count{};
+        size_t                                 _pending{};
+        size_t                                 _active{};
+        size_t                                 _generation{};
+        bool                                   _stop{};
+    };
+} // namespace box